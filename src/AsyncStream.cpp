@@ -0,0 +1,451 @@
+#include "AsyncStream.h"
+#include "NativeFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CS_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+using namespace cs;
+
+constexpr const char* exceptionReadError = "Failed to read data";
+constexpr const char* exceptionWriteError = "Failed to write data";
+
+namespace cs
+{
+    /**
+     * Owns the native file handle and performs the actual reads and writes for AsyncFileStream.
+     * Each write is associated with one of the stream's buffer slots.
+     */
+    class AsyncIoBackend
+    {
+    public:
+        static constexpr size_t numSlots = 2;
+
+    protected:
+        NativeFile _file;
+
+    public:
+        AsyncIoBackend(const fs::path& path, uint8_t flags)
+            : _file(path, flags)
+        {
+        }
+
+        virtual ~AsyncIoBackend() = default;
+
+        NativeFile& getFile()
+        {
+            return _file;
+        }
+
+        virtual AsyncBackend getKind() const = 0;
+        virtual void submitWrite(size_t slot, uint64_t offset, const void* buffer, size_t len) = 0;
+        virtual void wait(size_t slot) = 0;
+    };
+}
+
+namespace
+{
+    class ThreadPoolBackend final : public AsyncIoBackend
+    {
+    private:
+        // A single worker is enough to overlap I/O with the caller
+        ThreadPool _pool{ 1 };
+        std::future<void> _pending[numSlots];
+
+    public:
+        using AsyncIoBackend::AsyncIoBackend;
+
+        ~ThreadPoolBackend() override
+        {
+            for (auto& pending : _pending)
+            {
+                if (pending.valid())
+                    pending.wait();
+            }
+        }
+
+        AsyncBackend getKind() const override
+        {
+            return AsyncBackend::threadPool;
+        }
+
+        void submitWrite(size_t slot, uint64_t offset, const void* buffer, size_t len) override
+        {
+            _pending[slot] = _pool.enqueue([this, offset, buffer, len]() { _file.writeAt(offset, buffer, len); });
+        }
+
+        void wait(size_t slot) override
+        {
+            if (_pending[slot].valid())
+            {
+                // Rethrows any exception from the worker
+                _pending[slot].get();
+            }
+        }
+    };
+
+#ifdef CS_HAS_IO_URING
+    /**
+     * Drives a small io_uring instance directly through the kernel interface. Only one
+     * submission per buffer slot is ever outstanding, so the rings are kept tiny.
+     */
+    class IoUringBackend final : public AsyncIoBackend
+    {
+    private:
+        struct Request
+        {
+            iovec iov{};
+            uint64_t offset{};
+            int32_t result{};
+            bool pending{};
+        };
+
+        int _ringFd = -1;
+        void* _sqRing = MAP_FAILED;
+        void* _cqRing = MAP_FAILED;
+        size_t _sqRingSize{};
+        size_t _cqRingSize{};
+        io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        size_t _sqesSize{};
+
+        unsigned* _sqTail{};
+        unsigned* _sqMask{};
+        unsigned* _sqArray{};
+        unsigned* _cqHead{};
+        unsigned* _cqTail{};
+        unsigned* _cqMask{};
+        io_uring_cqe* _cqes{};
+
+        Request _requests[numSlots];
+
+        static int setup(unsigned entries, io_uring_params* params)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+        }
+
+        int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+
+        void release()
+        {
+            if (_sqes != MAP_FAILED)
+                ::munmap(_sqes, _sqesSize);
+            if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+                ::munmap(_cqRing, _cqRingSize);
+            if (_sqRing != MAP_FAILED)
+                ::munmap(_sqRing, _sqRingSize);
+            if (_ringFd != -1)
+                ::close(_ringFd);
+        }
+
+        void reapCompletion()
+        {
+            auto head = *_cqHead;
+            auto tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            if (head == tail)
+            {
+                if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                    throw std::runtime_error(exceptionWriteError);
+                return;
+            }
+
+            const auto& cqe = _cqes[head & *_cqMask];
+            auto& request = _requests[cqe.user_data];
+            request.result = cqe.res;
+            request.pending = false;
+            __atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+        }
+
+    public:
+        IoUringBackend(const fs::path& path, uint8_t flags)
+            : AsyncIoBackend(path, flags)
+        {
+            io_uring_params params{};
+            _ringFd = setup(numSlots, &params);
+            if (_ringFd < 0)
+            {
+                _ringFd = -1;
+                throw std::runtime_error("io_uring is not available");
+            }
+
+            _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+            }
+
+            _sqRing = ::mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                _cqRing = _sqRing;
+            else
+                _cqRing = ::mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+            _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            _sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES));
+            if (_sqRing == MAP_FAILED || _cqRing == MAP_FAILED || _sqes == MAP_FAILED)
+            {
+                release();
+                throw std::runtime_error("io_uring is not available");
+            }
+
+            auto sq = static_cast<std::byte*>(_sqRing);
+            _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            _sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+            auto cq = static_cast<std::byte*>(_cqRing);
+            _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            _cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        }
+
+        ~IoUringBackend() override
+        {
+            try
+            {
+                for (size_t i = 0; i < numSlots; i++)
+                {
+                    while (_requests[i].pending)
+                        reapCompletion();
+                }
+            }
+            catch (...)
+            {
+            }
+            release();
+        }
+
+        AsyncBackend getKind() const override
+        {
+            return AsyncBackend::ioUring;
+        }
+
+        void submitWrite(size_t slot, uint64_t offset, const void* buffer, size_t len) override
+        {
+            auto& request = _requests[slot];
+            request.iov.iov_base = const_cast<void*>(buffer);
+            request.iov.iov_len = len;
+            request.offset = offset;
+            request.result = 0;
+            request.pending = true;
+
+            // We are the only producer, so the tail can be read without synchronisation
+            auto tail = *_sqTail;
+            auto index = tail & *_sqMask;
+            auto& sqe = _sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_WRITEV;
+            sqe.fd = _file.getDescriptor();
+            sqe.addr = reinterpret_cast<uint64_t>(&request.iov);
+            sqe.len = 1;
+            sqe.off = offset;
+            sqe.user_data = slot;
+            _sqArray[index] = index;
+            __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+            int result;
+            do
+            {
+                result = enter(1, 0, 0);
+            } while (result < 0 && errno == EINTR);
+            if (result < 0)
+            {
+                request.pending = false;
+                throw std::runtime_error(exceptionWriteError);
+            }
+        }
+
+        void wait(size_t slot) override
+        {
+            auto& request = _requests[slot];
+            while (request.pending)
+            {
+                reapCompletion();
+            }
+            if (request.result < 0)
+            {
+                request.result = 0;
+                throw std::runtime_error(exceptionWriteError);
+            }
+
+            // Short writes are unusual for regular files, finish them synchronously
+            auto written = static_cast<size_t>(request.result);
+            if (written < request.iov.iov_len)
+            {
+                auto remaining = static_cast<const std::byte*>(request.iov.iov_base) + written;
+                _file.writeAt(request.offset + written, remaining, request.iov.iov_len - written);
+            }
+            request.iov = {};
+        }
+    };
+#endif
+
+    std::unique_ptr<AsyncIoBackend> createBackend(const fs::path& path, uint8_t flags, AsyncBackend kind)
+    {
+#ifdef CS_HAS_IO_URING
+        if (kind != AsyncBackend::threadPool)
+        {
+            try
+            {
+                return std::make_unique<IoUringBackend>(path, flags);
+            }
+            catch (const std::exception&)
+            {
+                // Fall back to the thread pool, e.g. io_uring may be disabled by seccomp
+            }
+        }
+#endif
+        return std::make_unique<ThreadPoolBackend>(path, flags);
+    }
+}
+
+AsyncFileStream::AsyncFileStream(const fs::path& path, uint8_t flags, AsyncBackend backend, size_t bufferSize)
+    : _backend(createBackend(path, flags, backend))
+    , _bufferSize(std::max<size_t>(1, bufferSize))
+{
+    _length = _backend->getFile().getSize();
+    if (flags & StreamFlags::write)
+    {
+        for (auto& buffer : _buffers)
+        {
+            buffer.data = std::make_unique<std::byte[]>(_bufferSize);
+        }
+    }
+}
+
+AsyncFileStream::~AsyncFileStream()
+{
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+    }
+}
+
+uint64_t AsyncFileStream::getLength() const
+{
+    return _length;
+}
+
+uint64_t AsyncFileStream::getPosition() const
+{
+    return _position;
+}
+
+void AsyncFileStream::setPosition(uint64_t position)
+{
+    if (position != _position)
+    {
+        // The active buffer must always be contiguous
+        submit();
+        _position = position;
+    }
+}
+
+void AsyncFileStream::read(void* buffer, size_t len)
+{
+    if (len > _length || _position > _length - len)
+        throw std::runtime_error(exceptionReadError);
+
+    flush();
+    _backend->getFile().readAt(_position, buffer, len);
+    _position += len;
+}
+
+void AsyncFileStream::write(const void* buffer, size_t len)
+{
+    if (_buffers[0].data == nullptr)
+        throw std::runtime_error(exceptionWriteError);
+
+    auto src = static_cast<const std::byte*>(buffer);
+    while (len != 0)
+    {
+        auto& active = _buffers[_active];
+        if (active.len == 0)
+        {
+            active.offset = _position;
+        }
+
+        auto copyLen = std::min(len, _bufferSize - active.len);
+        std::memcpy(active.data.get() + active.len, src, copyLen);
+        active.len += copyLen;
+        src += copyLen;
+        len -= copyLen;
+        _position += copyLen;
+        _length = std::max(_length, _position);
+
+        if (active.len == _bufferSize)
+        {
+            submit();
+        }
+    }
+}
+
+void AsyncFileStream::flush()
+{
+    submit();
+    wait();
+}
+
+void AsyncFileStream::submit()
+{
+    auto& active = _buffers[_active];
+    if (active.len == 0)
+        return;
+
+    _backend->submitWrite(_active, active.offset, active.data.get(), active.len);
+    active.pending = true;
+
+    // Swap to the other buffer, it may still be in flight from the previous submission
+    _active = (_active + 1) % AsyncIoBackend::numSlots;
+    auto& next = _buffers[_active];
+    if (next.pending)
+    {
+        next.pending = false;
+        _backend->wait(_active);
+    }
+    next.len = 0;
+}
+
+void AsyncFileStream::wait()
+{
+    for (size_t i = 0; i < AsyncIoBackend::numSlots; i++)
+    {
+        auto& buffer = _buffers[i];
+        if (buffer.pending)
+        {
+            buffer.pending = false;
+            if (i != _active)
+            {
+                buffer.len = 0;
+            }
+            _backend->wait(i);
+        }
+    }
+}
+
+AsyncBackend AsyncFileStream::getBackend() const
+{
+    return _backend->getKind();
+}
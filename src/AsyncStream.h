@@ -0,0 +1,81 @@
+#pragma once
+
+#include "FileSystem.hpp"
+#include "Stream.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace cs
+{
+    enum class AsyncBackend : uint8_t
+    {
+        automatic,
+        ioUring,
+        threadPool,
+    };
+
+    class AsyncIoBackend;
+
+    /**
+     * A file stream which performs writes in the background so that the caller can carry on
+     * producing data while earlier writes are still in flight.
+     *
+     * Written data is collected in one of two buffers. When the active buffer is full, it is
+     * submitted to the backend and writing continues into the other buffer. The backend is
+     * io_uring on Linux when the kernel supports it, otherwise a worker thread.
+     *
+     * Reading waits for all pending writes to complete first.
+     */
+    class AsyncFileStream final : public Stream
+    {
+    public:
+        static constexpr size_t defaultBufferSize = 1024 * 1024;
+
+    private:
+        struct Buffer
+        {
+            std::unique_ptr<std::byte[]> data;
+            uint64_t offset{};
+            size_t len{};
+            bool pending{};
+        };
+
+        // Buffers must outlive the backend as it may still be writing from them
+        Buffer _buffers[2];
+        std::unique_ptr<AsyncIoBackend> _backend;
+        size_t _active{};
+        size_t _bufferSize{};
+        uint64_t _position{};
+        uint64_t _length{};
+
+    public:
+        AsyncFileStream(const fs::path& path, uint8_t flags, AsyncBackend backend = AsyncBackend::automatic, size_t bufferSize = defaultBufferSize);
+        AsyncFileStream(const AsyncFileStream&) = delete;
+        AsyncFileStream& operator=(const AsyncFileStream&) = delete;
+        ~AsyncFileStream() override;
+
+        uint64_t getLength() const override;
+        uint64_t getPosition() const override;
+        void setPosition(uint64_t position) override;
+        void read(void* buffer, size_t len) override;
+        void write(const void* buffer, size_t len) override;
+
+        /**
+         * Submits the active buffer and waits for all pending writes to complete.
+         */
+        void flush() override;
+
+        /**
+         * Submits the active buffer to the backend without waiting for it to complete.
+         */
+        void submit();
+
+        /**
+         * Waits for all submitted writes to complete.
+         */
+        void wait();
+
+        AsyncBackend getBackend() const;
+    };
+}
@@ -0,0 +1,470 @@
+#include "CompressionStream.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#ifdef CS_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CS_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace cs;
+
+constexpr const char* exceptionReadError = "Failed to read data";
+constexpr const char* exceptionCompressError = "Failed to compress data";
+constexpr const char* exceptionDecompressError = "Failed to decompress data";
+constexpr const char* exceptionUnexpectedEnd = "Unexpected end of compressed data";
+
+namespace cs
+{
+    class Compressor
+    {
+    public:
+        enum class Mode
+        {
+            none,
+            flush,
+            finish,
+        };
+
+    protected:
+        Stream& _stream;
+        std::unique_ptr<std::byte[]> _buffer;
+        size_t _bufferSize{};
+
+        void writeOutput(size_t len)
+        {
+            if (len != 0)
+            {
+                _stream.write(_buffer.get(), len);
+            }
+        }
+
+    public:
+        Compressor(Stream& stream, size_t blockSize)
+            : _stream(stream)
+            , _buffer(std::make_unique<std::byte[]>(std::max<size_t>(1, blockSize)))
+            , _bufferSize(std::max<size_t>(1, blockSize))
+        {
+        }
+
+        virtual ~Compressor() = default;
+
+        /**
+         * Compresses all the given data. Output is only guaranteed to be written to the
+         * underlying stream for the flush and finish modes.
+         */
+        virtual void compress(const void* data, size_t len, Mode mode) = 0;
+    };
+
+    class Decompressor
+    {
+    protected:
+        Stream& _stream;
+        std::unique_ptr<std::byte[]> _buffer;
+        size_t _bufferSize{};
+        bool _finished{};
+
+        /**
+         * Reads the next block of compressed data into the buffer.
+         * @returns the number of bytes read, 0 if there is no more data.
+         */
+        size_t readInput()
+        {
+            auto remaining = _stream.getLength() - _stream.getPosition();
+            auto len = static_cast<size_t>(std::min<uint64_t>(remaining, _bufferSize));
+            if (len != 0)
+            {
+                _stream.read(_buffer.get(), len);
+            }
+            return len;
+        }
+
+        /**
+         * Moves the underlying stream back to the end of the compressed data.
+         */
+        void returnInput(size_t unusedLen)
+        {
+            _finished = true;
+            if (unusedLen != 0)
+            {
+                _stream.setPosition(_stream.getPosition() - unusedLen);
+            }
+        }
+
+    public:
+        Decompressor(Stream& stream, size_t blockSize)
+            : _stream(stream)
+            , _buffer(std::make_unique<std::byte[]>(std::max<size_t>(1, blockSize)))
+            , _bufferSize(std::max<size_t>(1, blockSize))
+        {
+        }
+
+        virtual ~Decompressor() = default;
+
+        /**
+         * Decompresses up to len bytes into the given buffer.
+         * @returns the number of bytes written to buffer, less than len only at the end of the data.
+         */
+        virtual size_t decompress(void* buffer, size_t len) = 0;
+    };
+}
+
+namespace
+{
+    // zlib counts bytes with 32-bit integers
+    constexpr size_t maxZlibChunk = 1024 * 1024 * 1024;
+
+#ifdef CS_ENABLE_ZLIB
+    class ZlibCompressor final : public Compressor
+    {
+    private:
+        z_stream _z{};
+
+    public:
+        ZlibCompressor(Stream& stream, std::optional<int32_t> level, size_t blockSize)
+            : Compressor(stream, std::min(blockSize, maxZlibChunk))
+        {
+            if (deflateInit(&_z, level.value_or(Z_DEFAULT_COMPRESSION)) != Z_OK)
+                throw std::runtime_error(exceptionCompressError);
+        }
+
+        ~ZlibCompressor() override
+        {
+            deflateEnd(&_z);
+        }
+
+        void compress(const void* data, size_t len, Mode mode) override
+        {
+            auto src = static_cast<const Bytef*>(data);
+            do
+            {
+                auto chunkLen = std::min(len, maxZlibChunk);
+                auto lastChunk = chunkLen == len;
+                auto flush = Z_NO_FLUSH;
+                if (lastChunk && mode == Mode::flush)
+                    flush = Z_SYNC_FLUSH;
+                else if (lastChunk && mode == Mode::finish)
+                    flush = Z_FINISH;
+
+                _z.next_in = const_cast<Bytef*>(src);
+                _z.avail_in = static_cast<uInt>(chunkLen);
+                int result;
+                do
+                {
+                    _z.next_out = reinterpret_cast<Bytef*>(_buffer.get());
+                    _z.avail_out = static_cast<uInt>(_bufferSize);
+                    result = deflate(&_z, flush);
+                    if (result == Z_STREAM_ERROR)
+                        throw std::runtime_error(exceptionCompressError);
+                    writeOutput(_bufferSize - _z.avail_out);
+                } while (_z.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+
+                src += chunkLen;
+                len -= chunkLen;
+            } while (len != 0);
+        }
+    };
+
+    class ZlibDecompressor final : public Decompressor
+    {
+    private:
+        z_stream _z{};
+
+    public:
+        ZlibDecompressor(Stream& stream, size_t blockSize)
+            : Decompressor(stream, std::min(blockSize, maxZlibChunk))
+        {
+            if (inflateInit(&_z) != Z_OK)
+                throw std::runtime_error(exceptionDecompressError);
+        }
+
+        ~ZlibDecompressor() override
+        {
+            inflateEnd(&_z);
+        }
+
+        size_t decompress(void* buffer, size_t len) override
+        {
+            auto dst = static_cast<Bytef*>(buffer);
+            size_t totalLen = 0;
+            while (totalLen < len && !_finished)
+            {
+                if (_z.avail_in == 0)
+                {
+                    auto inputLen = readInput();
+                    if (inputLen == 0)
+                        throw std::runtime_error(exceptionUnexpectedEnd);
+                    _z.next_in = reinterpret_cast<Bytef*>(_buffer.get());
+                    _z.avail_in = static_cast<uInt>(inputLen);
+                }
+
+                auto chunkLen = std::min(len - totalLen, maxZlibChunk);
+                _z.next_out = dst + totalLen;
+                _z.avail_out = static_cast<uInt>(chunkLen);
+                auto result = inflate(&_z, Z_NO_FLUSH);
+                totalLen += chunkLen - _z.avail_out;
+                if (result == Z_STREAM_END)
+                {
+                    returnInput(_z.avail_in);
+                }
+                else if (result != Z_OK && !(result == Z_BUF_ERROR && _z.avail_in == 0))
+                {
+                    throw std::runtime_error(exceptionDecompressError);
+                }
+            }
+            return totalLen;
+        }
+    };
+#endif
+
+#ifdef CS_ENABLE_ZSTD
+    class ZstdCompressor final : public Compressor
+    {
+    private:
+        ZSTD_CCtx* _cctx{};
+
+    public:
+        ZstdCompressor(Stream& stream, std::optional<int32_t> level, size_t blockSize)
+            : Compressor(stream, blockSize)
+        {
+            _cctx = ZSTD_createCCtx();
+            if (_cctx == nullptr)
+                throw std::runtime_error(exceptionCompressError);
+            ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, level.value_or(ZSTD_CLEVEL_DEFAULT));
+        }
+
+        ~ZstdCompressor() override
+        {
+            ZSTD_freeCCtx(_cctx);
+        }
+
+        void compress(const void* data, size_t len, Mode mode) override
+        {
+            auto directive = ZSTD_e_continue;
+            if (mode == Mode::flush)
+                directive = ZSTD_e_flush;
+            else if (mode == Mode::finish)
+                directive = ZSTD_e_end;
+
+            ZSTD_inBuffer input{ data, len, 0 };
+            bool done;
+            do
+            {
+                ZSTD_outBuffer output{ _buffer.get(), _bufferSize, 0 };
+                auto remaining = ZSTD_compressStream2(_cctx, &output, &input, directive);
+                if (ZSTD_isError(remaining))
+                    throw std::runtime_error(exceptionCompressError);
+                writeOutput(output.pos);
+                done = directive == ZSTD_e_continue ? input.pos == input.size : remaining == 0;
+            } while (!done);
+        }
+    };
+
+    class ZstdDecompressor final : public Decompressor
+    {
+    private:
+        ZSTD_DCtx* _dctx{};
+        ZSTD_inBuffer _input{};
+
+    public:
+        ZstdDecompressor(Stream& stream, size_t blockSize)
+            : Decompressor(stream, blockSize)
+        {
+            _dctx = ZSTD_createDCtx();
+            if (_dctx == nullptr)
+                throw std::runtime_error(exceptionDecompressError);
+            _input.src = _buffer.get();
+        }
+
+        ~ZstdDecompressor() override
+        {
+            ZSTD_freeDCtx(_dctx);
+        }
+
+        size_t decompress(void* buffer, size_t len) override
+        {
+            ZSTD_outBuffer output{ buffer, len, 0 };
+            while (output.pos < output.size && !_finished)
+            {
+                if (_input.pos == _input.size)
+                {
+                    _input.size = readInput();
+                    _input.pos = 0;
+                    if (_input.size == 0)
+                        throw std::runtime_error(exceptionUnexpectedEnd);
+                }
+
+                auto result = ZSTD_decompressStream(_dctx, &output, &_input);
+                if (ZSTD_isError(result))
+                    throw std::runtime_error(exceptionDecompressError);
+                if (result == 0)
+                {
+                    // End of frame, everything has been flushed
+                    returnInput(_input.size - _input.pos);
+                }
+            }
+            return output.pos;
+        }
+    };
+#endif
+
+    [[noreturn]] void throwFormatNotAvailable(CompressionFormat format)
+    {
+        if (format == CompressionFormat::zstd)
+            throw std::runtime_error("zstd not available");
+        else
+            throw std::runtime_error("zlib not available");
+    }
+
+    std::unique_ptr<Compressor> createCompressor(Stream& stream, CompressionFormat format, std::optional<int32_t> level, size_t blockSize)
+    {
+        switch (format)
+        {
+#ifdef CS_ENABLE_ZLIB
+            case CompressionFormat::zlib:
+                return std::make_unique<ZlibCompressor>(stream, level, blockSize);
+#endif
+#ifdef CS_ENABLE_ZSTD
+            case CompressionFormat::zstd:
+                return std::make_unique<ZstdCompressor>(stream, level, blockSize);
+#endif
+            default:
+                throwFormatNotAvailable(format);
+        }
+    }
+
+    std::unique_ptr<Decompressor> createDecompressor(Stream& stream, CompressionFormat format, size_t blockSize)
+    {
+        switch (format)
+        {
+#ifdef CS_ENABLE_ZLIB
+            case CompressionFormat::zlib:
+                return std::make_unique<ZlibDecompressor>(stream, blockSize);
+#endif
+#ifdef CS_ENABLE_ZSTD
+            case CompressionFormat::zstd:
+                return std::make_unique<ZstdDecompressor>(stream, blockSize);
+#endif
+            default:
+                throwFormatNotAvailable(format);
+        }
+    }
+}
+
+CompressingStream::CompressingStream(Stream& stream, CompressionFormat format, std::optional<int32_t> level, size_t blockSize)
+    : _compressor(createCompressor(stream, format, level, blockSize))
+    , _stream(&stream)
+{
+}
+
+CompressingStream::~CompressingStream()
+{
+    try
+    {
+        finish();
+    }
+    catch (...)
+    {
+    }
+}
+
+uint64_t CompressingStream::getLength() const
+{
+    return _position;
+}
+
+uint64_t CompressingStream::getPosition() const
+{
+    return _position;
+}
+
+void CompressingStream::write(const void* buffer, size_t len)
+{
+    if (_compressor == nullptr)
+        throw std::runtime_error("Compressed stream has already been finished");
+
+    if (len != 0)
+    {
+        _compressor->compress(buffer, len, Compressor::Mode::none);
+        _position += len;
+    }
+}
+
+void CompressingStream::flush()
+{
+    if (_compressor != nullptr)
+    {
+        _compressor->compress(nullptr, 0, Compressor::Mode::flush);
+        _stream->flush();
+    }
+}
+
+void CompressingStream::finish()
+{
+    if (_compressor != nullptr)
+    {
+        // Release the compressor even if writing the final block fails
+        auto compressor = std::move(_compressor);
+        compressor->compress(nullptr, 0, Compressor::Mode::finish);
+        _stream->flush();
+    }
+}
+
+bool CompressingStream::isSupported(CompressionFormat format)
+{
+    switch (format)
+    {
+#ifdef CS_ENABLE_ZLIB
+        case CompressionFormat::zlib:
+            return true;
+#endif
+#ifdef CS_ENABLE_ZSTD
+        case CompressionFormat::zstd:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+DecompressingStream::DecompressingStream(Stream& stream, CompressionFormat format, size_t blockSize)
+    : _decompressor(createDecompressor(stream, format, blockSize))
+{
+}
+
+DecompressingStream::~DecompressingStream() = default;
+
+uint64_t DecompressingStream::getPosition() const
+{
+    return _position;
+}
+
+void DecompressingStream::setPosition(uint64_t position)
+{
+    if (position < _position)
+        throw std::runtime_error("Can not seek backwards in a decompressing stream");
+
+    std::byte discard[4096];
+    while (_position < position)
+    {
+        auto len = static_cast<size_t>(std::min<uint64_t>(sizeof(discard), position - _position));
+        read(discard, len);
+    }
+}
+
+void DecompressingStream::read(void* buffer, size_t len)
+{
+    if (readSome(buffer, len) != len)
+        throw std::runtime_error(exceptionReadError);
+}
+
+size_t DecompressingStream::readSome(void* buffer, size_t len)
+{
+    auto readLen = _decompressor->decompress(buffer, len);
+    _position += readLen;
+    return readLen;
+}
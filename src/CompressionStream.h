@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Stream.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace cs
+{
+    enum class CompressionFormat : uint8_t
+    {
+        zlib,
+        zstd,
+    };
+
+    class Compressor;
+    class Decompressor;
+
+    /**
+     * A write-only stream which compresses everything written to it and writes the result
+     * to another stream. The compressed stream is completed by finish(), which is also called
+     * by the destructor if it has not been called already.
+     */
+    class CompressingStream final : public Stream
+    {
+    public:
+        static constexpr size_t defaultBlockSize = 128 * 1024;
+
+    private:
+        std::unique_ptr<Compressor> _compressor;
+        Stream* _stream{};
+        uint64_t _position{};
+
+    public:
+        /**
+         * @param level the compression level, or the format's default if not specified.
+         * @param blockSize the size of the buffer compressed data is collected into before being
+         *                  written to the underlying stream.
+         */
+        CompressingStream(Stream& stream, CompressionFormat format, std::optional<int32_t> level = std::nullopt, size_t blockSize = defaultBlockSize);
+        CompressingStream(const CompressingStream&) = delete;
+        CompressingStream& operator=(const CompressingStream&) = delete;
+        ~CompressingStream() override;
+
+        uint64_t getLength() const override;
+        uint64_t getPosition() const override;
+        void write(const void* buffer, size_t len) override;
+
+        /**
+         * Writes all data compressed so far to the underlying stream without ending the compressed stream.
+         */
+        void flush() override;
+
+        /**
+         * Ends the compressed stream, no further data can be written afterwards.
+         */
+        void finish();
+
+        static bool isSupported(CompressionFormat format);
+    };
+
+    /**
+     * A read-only stream which decompresses data read from another stream. Seeking is only
+     * supported forwards. When the end of the compressed data is reached, the underlying stream
+     * is positioned directly after it.
+     */
+    class DecompressingStream final : public Stream
+    {
+    public:
+        static constexpr size_t defaultBlockSize = 128 * 1024;
+
+    private:
+        std::unique_ptr<Decompressor> _decompressor;
+        uint64_t _position{};
+
+    public:
+        /**
+         * @param blockSize the size of the chunks compressed data is read from the underlying stream in.
+         */
+        DecompressingStream(Stream& stream, CompressionFormat format, size_t blockSize = defaultBlockSize);
+        DecompressingStream(const DecompressingStream&) = delete;
+        DecompressingStream& operator=(const DecompressingStream&) = delete;
+        ~DecompressingStream() override;
+
+        uint64_t getPosition() const override;
+        void setPosition(uint64_t position) override;
+        void read(void* buffer, size_t len) override;
+
+        /**
+         * Reads up to len bytes, less if the end of the compressed data is reached.
+         * @returns the number of bytes read.
+         */
+        size_t readSome(void* buffer, size_t len);
+    };
+}
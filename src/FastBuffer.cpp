@@ -0,0 +1,119 @@
+#include "FastBuffer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+using namespace cs;
+
+uint8_t* FastBuffer::alloc(size_t len)
+{
+#ifdef _WIN32
+    return reinterpret_cast<uint8_t*>(HeapAlloc(GetProcessHeap(), 0, len));
+#else
+    return reinterpret_cast<uint8_t*>(std::malloc(len));
+#endif
+}
+
+uint8_t* FastBuffer::realloc(uint8_t* ptr, size_t len)
+{
+#ifdef _WIN32
+    return reinterpret_cast<uint8_t*>(HeapReAlloc(GetProcessHeap(), 0, ptr, len));
+#else
+    return reinterpret_cast<uint8_t*>(std::realloc(ptr, len));
+#endif
+}
+
+void FastBuffer::free(uint8_t* ptr)
+{
+#ifdef _WIN32
+    HeapFree(GetProcessHeap(), 0, ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+FastBuffer::~FastBuffer()
+{
+    if (_data != nullptr)
+    {
+        free(_data);
+        _data = 0;
+        _len = 0;
+        _capacity = 0;
+    }
+}
+
+uint8_t* FastBuffer::data()
+{
+    return _data;
+}
+
+size_t FastBuffer::size() const
+{
+    return _len;
+}
+
+void FastBuffer::resize(size_t len)
+{
+    reserve(len);
+    _len = len;
+}
+
+void FastBuffer::reserve(size_t len)
+{
+    if (_capacity < len)
+    {
+        do
+        {
+            _capacity = std::max<size_t>(256, _capacity * 2);
+        } while (_capacity < len);
+        auto newData = _data == nullptr ? alloc(_capacity) : realloc(_data, _capacity);
+        if (newData == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        else
+        {
+            _data = reinterpret_cast<uint8_t*>(newData);
+        }
+    }
+}
+
+void FastBuffer::clear()
+{
+    _len = 0;
+}
+
+void FastBuffer::push_back(uint8_t value)
+{
+    reserve(_len + 1);
+    _data[_len++] = value;
+}
+
+void FastBuffer::push_back(uint8_t value, size_t len)
+{
+    reserve(_len + len);
+    std::memset(&_data[_len], value, len);
+    _len += len;
+}
+
+void FastBuffer::push_back(const uint8_t* src, size_t len)
+{
+    reserve(_len + len);
+    std::memcpy(&_data[_len], src, len);
+    _len += len;
+}
+
+stdx::span<uint8_t const> FastBuffer::getSpan() const
+{
+    return stdx::span<uint8_t const>(_data, _len);
+}
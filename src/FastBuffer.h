@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Span.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace cs
+{
+    /**
+     * Provides a more efficient implementation than std::vector for allocating and
+     * pushing bytes to a buffer.
+     *
+     * In particular, for Windows, HeapAlloc is used for a direct memory block from the OS
+     * which is not initialised (even in debug builds). It vastly reduces the time needed
+     * to load / save S5 files in debug builds.
+     */
+    class FastBuffer
+    {
+    private:
+        uint8_t* _data{};
+        size_t _len{};
+        size_t _capacity{};
+
+        static uint8_t* alloc(size_t len);
+        static uint8_t* realloc(uint8_t* ptr, size_t len);
+        static void free(uint8_t* ptr);
+
+    public:
+        ~FastBuffer();
+
+        uint8_t* data();
+        size_t size() const;
+        void resize(size_t len);
+        void reserve(size_t len);
+        void clear();
+        void push_back(uint8_t value);
+        void push_back(uint8_t value, size_t len);
+        void push_back(const uint8_t* src, size_t len);
+        stdx::span<uint8_t const> getSpan() const;
+    };
+}
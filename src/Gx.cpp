@@ -1,7 +1,15 @@
 #include "Gx.h"
+#include "Numeric.h"
+#include <algorithm>
 #include <cstring>
 #include <limits>
 #include <optional>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CS_GX_SSE2
+#endif
 
 using namespace cs;
 
@@ -115,43 +123,239 @@ void GxEntry::convertToBmp(void* dst) const
 
 void GxEntry::convertRleToBmp(void* dst) const
 {
+    GxSurface surface;
+    surface.bits = static_cast<uint8_t*>(dst);
+    surface.width = width;
+    surface.height = height;
+    surface.stride = width;
+    drawRle(surface, 0, 0);
+}
+
+namespace
+{
+    template<size_t TLen>
+    void copyFixed(uint8_t* dst, const uint8_t* src)
+    {
+#ifdef CS_GX_SSE2
+        if constexpr (TLen == 16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+            return;
+        }
+#endif
+        // Fixed size copies compile to single loads and stores
+        std::memcpy(dst, src, TLen);
+    }
+
+    /**
+     * Copies a run of pixels using two fixed width copies that overlap in the middle of the run,
+     * rather than a variable length memcpy. Nothing outside of the run is read or written.
+     */
+    void copyRun(uint8_t* dst, const uint8_t* src, size_t len)
+    {
+        if (len >= 16)
+        {
+            // Runs are at most 127 pixels
+            size_t i = 0;
+            for (; i + 16 < len; i += 16)
+            {
+                copyFixed<16>(dst + i, src + i);
+            }
+            copyFixed<16>(dst + len - 16, src + len - 16);
+        }
+        else if (len >= 8)
+        {
+            copyFixed<8>(dst, src);
+            copyFixed<8>(dst + len - 8, src + len - 8);
+        }
+        else if (len >= 4)
+        {
+            copyFixed<4>(dst, src);
+            copyFixed<4>(dst + len - 4, src + len - 4);
+        }
+        else if (len >= 2)
+        {
+            copyFixed<2>(dst, src);
+            copyFixed<2>(dst + len - 2, src + len - 2);
+        }
+        else if (len == 1)
+        {
+            *dst = *src;
+        }
+    }
+}
+
+void GxEntry::drawRle(const GxSurface& surface, int32_t x, int32_t y) const
+{
+    // Visible region in image coordinates
+    auto top = std::max<int32_t>(0, -y);
+    auto bottom = std::min<int32_t>(height, surface.height - y);
+    auto left = std::max<int32_t>(0, -x);
+    auto right = std::min<int32_t>(width, surface.width - x);
+    if (top >= bottom || left >= right)
+        return;
+
     auto startAddress = static_cast<const uint8_t*>(offset);
-    auto dst8 = static_cast<uint8_t*>(dst);
-    for (int32_t y = 0; y < height; y++)
+    auto clipX = left > 0 || right < width;
+    auto dstRow = surface.bits + static_cast<ptrdiff_t>(y + top) * surface.stride;
+    for (auto row = top; row < bottom; row++)
     {
-        // Set source pointer to the start of the row
-        auto rowOffset8 = startAddress + (y * 2);
+        // Rows above the surface are skipped without reading their data
+        auto rowOffset8 = startAddress + (row * 2);
         uint16_t rowOffset = rowOffset8[0] | (rowOffset8[1] << 8);
         auto src8 = startAddress + rowOffset;
 
-        // Read row offset
-        int32_t x = 0;
         auto endOfRow = false;
         do
         {
             // Get run length, end flag and x position
-            auto code = *src8++;
-            auto len = code & GxRleRowLengthMask;
+            auto code = src8[0];
+            int32_t len = code & GxRleRowLengthMask;
+            int32_t runX = src8[1];
             endOfRow = (code & GxRleRowEndFlag) != 0;
-            x = *src8++;
+            auto pixels = src8 + 2;
+            src8 = pixels + len;
 
-            // Copy pixel run to destination buffer
-            std::memcpy(dst8 + x, src8, len);
-            src8 += len;
+            if (clipX)
+            {
+                auto runLeft = std::max(runX, left);
+                auto runRight = std::min(runX + len, right);
+                if (runLeft < runRight)
+                {
+                    copyRun(dstRow + (x + runLeft), pixels + (runLeft - runX), runRight - runLeft);
+                }
+            }
+            else
+            {
+                copyRun(dstRow + (x + runX), pixels, len);
+            }
         } while (!endOfRow);
 
-        // Move destination pointer to next row
-        dst8 += width;
+        dstRow += surface.stride;
+    }
+}
+
+namespace
+{
+    // Rounds value / 2^zoom towards positive infinity
+    int32_t zoomCeil(int32_t value, uint8_t zoom)
+    {
+        return -((-value) >> zoom);
+    }
+
+    template<bool TRemap, bool TSkipTransparent>
+    void drawPixels(uint8_t* dst, const uint8_t* src, int32_t count, int32_t step, const uint8_t* remap)
+    {
+        for (int32_t i = 0; i < count; i++)
+        {
+            auto paletteIndex = *src;
+            src += step;
+            if constexpr (TSkipTransparent)
+            {
+                if (paletteIndex == 0)
+                    continue;
+            }
+            if constexpr (TRemap)
+            {
+                paletteIndex = remap[paletteIndex];
+            }
+            dst[i] = paletteIndex;
+        }
+    }
+
+    template<bool TRemap, bool TSkipTransparent>
+    void drawEntry(const GxEntry& entry, const GxSurface& surface, int32_t left, int32_t top, const GxDrawOptions& options)
+    {
+        auto zoom = options.zoom;
+        auto step = 1 << zoom;
+
+        // Destination rows whose zoom level 0 position is within the entry
+        auto dstTop = std::max<int32_t>(0, zoomCeil(top, zoom));
+        auto dstBottom = std::min<int32_t>(surface.height, zoomCeil(top + entry.height, zoom));
+        auto startAddress = static_cast<const uint8_t*>(entry.offset);
+        auto isRle = (entry.flags & GxFlags::rle) != 0;
+        for (auto dstY = dstTop; dstY < dstBottom; dstY++)
+        {
+            auto dstRow = surface.bits + static_cast<ptrdiff_t>(dstY) * surface.stride;
+            auto srcY = (dstY << zoom) - top;
+            if (isRle)
+            {
+                auto rowOffset8 = startAddress + (srcY * 2);
+                uint16_t rowOffset = rowOffset8[0] | (rowOffset8[1] << 8);
+                auto src8 = startAddress + rowOffset;
+
+                auto endOfRow = false;
+                do
+                {
+                    auto code = src8[0];
+                    int32_t len = code & GxRleRowLengthMask;
+                    int32_t runX = src8[1];
+                    endOfRow = (code & GxRleRowEndFlag) != 0;
+                    auto pixels = src8 + 2;
+                    src8 = pixels + len;
+
+                    auto dstLeft = std::max<int32_t>(0, zoomCeil(left + runX, zoom));
+                    auto dstRight = std::min<int32_t>(surface.width, zoomCeil(left + runX + len, zoom));
+                    if (dstLeft < dstRight)
+                    {
+                        auto src = pixels + ((dstLeft << zoom) - left - runX);
+                        drawPixels<TRemap, false>(dstRow + dstLeft, src, dstRight - dstLeft, step, options.remap);
+                    }
+                } while (!endOfRow);
+            }
+            else
+            {
+                auto dstLeft = std::max<int32_t>(0, zoomCeil(left, zoom));
+                auto dstRight = std::min<int32_t>(surface.width, zoomCeil(left + entry.width, zoom));
+                if (dstLeft < dstRight)
+                {
+                    auto src = startAddress + (static_cast<size_t>(srcY) * entry.width) + ((dstLeft << zoom) - left);
+                    drawPixels<TRemap, TSkipTransparent>(dstRow + dstLeft, src, dstRight - dstLeft, step, options.remap);
+                }
+            }
+        }
+    }
+}
+
+void GxEntry::draw(const GxSurface& surface, int32_t x, int32_t y, const GxDrawOptions& options) const
+{
+    if (flags & GxFlags::isPalette)
+        throw std::runtime_error("Palette can not be drawn");
+    if (options.zoom > 0 && (flags & GxFlags::noZoom))
+        return;
+    if (options.zoom >= 16)
+        throw std::invalid_argument("Invalid zoom level");
+
+    auto left = x + offsetX;
+    auto top = y + offsetY;
+    auto transparent = (flags & GxFlags::transparent) != 0;
+    if (options.remap != nullptr)
+    {
+        if (transparent)
+            drawEntry<true, true>(*this, surface, left, top, options);
+        else
+            drawEntry<true, false>(*this, surface, left, top, options);
+    }
+    else if (options.zoom == 0 && (flags & GxFlags::rle))
+    {
+        drawRle(surface, left, top);
+    }
+    else
+    {
+        if (transparent)
+            drawEntry<false, true>(*this, surface, left, top, options);
+        else
+            drawEntry<false, false>(*this, surface, left, top, options);
     }
 }
 
 bool GxEncoder::isWorthUsingRle(const ImageBuffer8& input)
 {
-    const auto* src = input.data;
     uint32_t averageTransparentRun = 0;
     uint32_t transparentRuns = 0;
     for (uint16_t y = 0; y < input.height; y++)
     {
+        const auto* src = input.data + y * input.getStride();
         uint32_t transparentRun = 0;
         for (uint16_t x = 0; x < input.width; x++)
         {
@@ -182,61 +386,142 @@ bool GxEncoder::isWorthUsingRle(const ImageBuffer8& input)
     return averageTransparentRun >= 4 && transparentRuns > 4;
 }
 
-void GxEncoder::encodeRle(const ImageBuffer8& input, Stream& stream)
+namespace
 {
-    const auto* src = input.data;
+    // Finds the first non-transparent pixel in [x, end), or end if there is none
+    int32_t findOpaquePixel(const uint8_t* row, int32_t x, int32_t end)
+    {
+#ifdef CS_GX_SSE2
+        auto zero = _mm_setzero_si128();
+        for (; x + 16 <= end; x += 16)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero))) ^ 0xFFFF;
+            if (mask != 0)
+                return x + bitScanForward(mask);
+        }
+#endif
+        while (x < end && row[x] == 0)
+            x++;
+        return x;
+    }
 
-    // Reserve space for row offsets
-    auto rowOffsetBegin = stream.getPosition();
-    stream.seek(input.height * 2);
+    // Finds the first transparent pixel in [x, end), or end if there is none
+    int32_t findTransparentPixel(const uint8_t* row, int32_t x, int32_t end)
+    {
+#ifdef CS_GX_SSE2
+        auto zero = _mm_setzero_si128();
+        for (; x + 16 <= end; x += 16)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero)));
+            if (mask != 0)
+                return x + bitScanForward(mask);
+        }
+#endif
+        while (x < end && row[x] != 0)
+            x++;
+        return x;
+    }
+}
 
-    for (auto y = 0; y < input.height; y++)
+namespace
+{
+    // At worst every pixel is a run of its own, plus an empty run to end each row
+    size_t getMaxRleSize(const ImageBuffer8& input)
     {
-        auto rowPosition = stream.getPosition();
-        auto rowOffset = static_cast<uint16_t>(rowPosition - rowOffsetBegin);
+        return input.height * 2 + static_cast<size_t>(input.height) * (input.width * 3 + 2);
+    }
+
+    /**
+     * Encodes the image into dst, which must be at least getMaxRleSize bytes.
+     * @returns the encoded length, or std::nullopt if it would exceed maxLen.
+     */
+    std::optional<size_t> writeRle(const ImageBuffer8& input, uint8_t* dst, size_t maxLen)
+    {
+        int32_t width = input.width;
+        int32_t height = input.height;
 
-        // Write row offset in table
-        stream.setPosition(rowOffsetBegin + (y * 2));
-        stream.write(&rowOffset, sizeof(rowOffset));
-        stream.setPosition(rowPosition);
+        auto rowOffsets = dst;
+        dst += height * 2;
 
-        // Write RLE codes
-        RLECode currentCode;
-        for (auto x = 0; x < input.width; x++)
+        const auto* src = input.data;
+        for (int32_t y = 0; y < height; y++)
         {
-            auto paletteIndex = *src++;
-            if (paletteIndex == 0)
-            {
-                // Transparent
-                if (currentCode.NumPixels != 0)
-                {
-                    pushRun(stream, currentCode);
-                }
-            }
-            else
+            auto rowOffset = static_cast<uint16_t>(dst - rowOffsets);
+            rowOffsets[y * 2] = rowOffset & 0xFF;
+            rowOffsets[y * 2 + 1] = rowOffset >> 8;
+
+            auto endOfRow = false;
+            int32_t x = 0;
+            while (!endOfRow)
             {
-                // Not transparent
-                if (currentCode.NumPixels == 0)
+                x = findOpaquePixel(src, x, width);
+                if (x == width)
                 {
-                    currentCode.OffsetX = x;
-                    currentCode.Pixels = src - 1;
+                    // Empty run to mark the end of the row
+                    dst[0] = GxRleRowEndFlag;
+                    dst[1] = 0;
+                    dst += 2;
+                    break;
                 }
-                currentCode.NumPixels++;
-            }
-            if (currentCode.NumPixels == GxRleRowLengthMask)
-            {
-                pushRun(stream, currentCode);
+
+                auto runEnd = findTransparentPixel(src, x, std::min(width, x + GxRleRowLengthMask));
+                auto len = runEnd - x;
+
+                // A full length run is always followed by another run, even if it ends the row
+                endOfRow = runEnd == width && len != GxRleRowLengthMask;
+                dst[0] = static_cast<uint8_t>(len) | (endOfRow ? GxRleRowEndFlag : 0);
+                dst[1] = static_cast<uint8_t>(x);
+                std::memcpy(dst + 2, src + x, len);
+                dst += 2 + len;
+                x = runEnd;
             }
+            src += input.getStride();
+
+            if (static_cast<size_t>(dst - rowOffsets) > maxLen)
+                return std::nullopt;
         }
-        currentCode.NumPixels |= GxRleRowEndFlag;
-        pushRun(stream, currentCode);
+        return dst - rowOffsets;
     }
 }
 
-void GxEncoder::pushRun(Stream& stream, RLECode& currentCode)
+void GxEncoder::encodeRle(const ImageBuffer8& input, Stream& stream)
 {
-    stream.write(&currentCode.NumPixels, 1);
-    stream.write(&currentCode.OffsetX, 1);
-    stream.write(currentCode.Pixels, currentCode.NumPixels & GxRleRowLengthMask);
-    currentCode = {};
+    FastBuffer buffer;
+    encodeRle(input, buffer);
+    stream.write(buffer.data(), buffer.size());
+}
+
+void GxEncoder::encodeRle(const ImageBuffer8& input, FastBuffer& output)
+{
+    output.resize(getMaxRleSize(input));
+    auto len = writeRle(input, output.data(), std::numeric_limits<size_t>::max());
+    output.resize(*len);
+}
+
+uint16_t GxEncoder::encodeSmallest(const ImageBuffer8& input, FastBuffer& output)
+{
+    // Row offsets are 16-bit, so larger RLE data can not be used
+    auto bmpLen = static_cast<size_t>(input.width) * input.height;
+    auto maxRleLen = std::min<size_t>(bmpLen - (bmpLen != 0 ? 1 : 0), std::numeric_limits<uint16_t>::max());
+    output.resize(getMaxRleSize(input));
+    auto rleLen = writeRle(input, output.data(), maxRleLen);
+    if (rleLen)
+    {
+        output.resize(*rleLen);
+        return GxFlags::transparent | GxFlags::rle;
+    }
+
+    output.clear();
+    if (input.getStride() == input.width)
+    {
+        output.push_back(input.data, bmpLen);
+    }
+    else
+    {
+        for (uint16_t y = 0; y < input.height; y++)
+            output.push_back(input.data + y * input.getStride(), input.width);
+    }
+    return GxFlags::transparent;
 }
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "FastBuffer.h"
 #include "Stream.h"
 #include <cstdint>
 #include <cstdlib>
@@ -27,6 +28,27 @@ namespace cs
         uint32_t dataSize{};
     };
 
+    /**
+     * An 8-bit destination for drawing entries onto. Rows are stride bytes apart, so a surface
+     * can refer to a rectangle within a larger buffer.
+     */
+    struct GxSurface
+    {
+        uint8_t* bits{};
+        int32_t width{};
+        int32_t height{};
+        int32_t stride{};
+    };
+
+    struct GxDrawOptions
+    {
+        // 256 entry table each drawn palette index is mapped through, or nullptr for no remapping
+        const uint8_t* remap{};
+
+        // Each zoom level halves the size the entry is drawn at
+        uint8_t zoom{};
+    };
+
     struct GxEntry
     {
         const void* offset{};
@@ -47,6 +69,43 @@ namespace cs
         void convertToBmp(Stream& stream) const;
         void convertToBmp(void* dst) const;
 
+        /**
+         * Decodes the entry's RLE data onto the surface with the top left of the image at (x, y).
+         * Pixels outside the surface are clipped and transparent pixels are left untouched.
+         */
+        void drawRle(const GxSurface& surface, int32_t x, int32_t y) const;
+
+        /**
+         * Draws the entry onto the surface at (x, y) plus the entry's offset. All coordinates are
+         * at zoom level 0 and are scaled down along with the entry for higher zoom levels.
+         * Entries with GxFlags::noZoom are only drawn at zoom level 0. Entries with GxFlags::hasZoom
+         * are drawn as they are, use drawFromSet to draw their zoomed entry instead.
+         */
+        void draw(const GxSurface& surface, int32_t x, int32_t y, const GxDrawOptions& options = {}) const;
+
+        /**
+         * Draws the entry at index in a set of entries, such as an archive, where getEntry returns
+         * the entry for an index. For higher zoom levels, entries with GxFlags::hasZoom are replaced
+         * by the entry zoomOffset entries before them, drawn one zoom level lower at (x, y) halved,
+         * rounding down.
+         */
+        template<typename TGetEntry>
+        static void drawFromSet(
+            TGetEntry&& getEntry, uint32_t index, const GxSurface& surface, int32_t x, int32_t y, const GxDrawOptions& options = {})
+        {
+            auto zoomedOptions = options;
+            GxEntry entry = getEntry(index);
+            while (zoomedOptions.zoom > 0 && (entry.flags & GxFlags::hasZoom) && entry.zoomOffset != 0 && entry.zoomOffset <= index)
+            {
+                index -= entry.zoomOffset;
+                entry = getEntry(index);
+                x >>= 1;
+                y >>= 1;
+                zoomedOptions.zoom--;
+            }
+            entry.draw(surface, x, y, zoomedOptions);
+        }
+
     private:
         std::pair<bool, size_t> calculateRleSize(size_t bufferLen) const;
         void convertRleToBmp(void* dst) const;
@@ -57,23 +116,33 @@ namespace cs
         uint16_t width{};
         uint16_t height{};
         const uint8_t* data{};
+
+        // Distance in bytes between the start of each row, 0 if the rows are tightly packed
+        uint32_t stride{};
+
+        size_t getStride() const
+        {
+            return stride != 0 ? stride : width;
+        }
     };
 
     class GxEncoder
     {
-    private:
-        struct RLECode
-        {
-            uint8_t NumPixels{};
-            uint8_t OffsetX{};
-            const uint8_t* Pixels{};
-        };
-
     public:
         bool isWorthUsingRle(const ImageBuffer8& input);
         void encodeRle(const ImageBuffer8& input, Stream& stream);
 
-    private:
-        void pushRun(Stream& stream, RLECode& currentCode);
+        /**
+         * Encodes the image into the buffer, replacing its contents. The buffer is sized for the
+         * worst case up front, so the row offset table and runs are written in a single pass.
+         */
+        void encodeRle(const ImageBuffer8& input, FastBuffer& output);
+
+        /**
+         * Encodes the image as RLE if that is smaller than the plain bitmap, otherwise copies the
+         * bitmap. The RLE size is exact and encoding stops as soon as it exceeds the bitmap size.
+         * @returns the flags for the chosen format.
+         */
+        uint16_t encodeSmallest(const ImageBuffer8& input, FastBuffer& output);
     };
 }
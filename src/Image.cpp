@@ -6,6 +6,7 @@
 
 #ifdef CS_ENABLE_LIBPNG
 #include <png.h>
+#include <zlib.h>
 #endif
 
 using namespace cs;
@@ -36,11 +37,99 @@ static void PngFlush(png_structp png_ptr)
 }
 #endif
 
-Image Image::fromPng(Stream& stream)
+#ifdef CS_ENABLE_LIBPNG
+/**
+ * Sets up libpng transforms so that rows are decoded straight into the given depth, one byte per
+ * component. Returns the depth rows will be decoded as.
+ */
+static uint32_t SetPngTransforms(png_structp pngPtr, png_infop infoPtr, uint32_t depth)
+{
+    auto colourType = png_get_color_type(pngPtr, infoPtr);
+    auto bitDepth = png_get_bit_depth(pngPtr, infoPtr);
+    if (depth == 0)
+    {
+        if (colourType == PNG_COLOR_TYPE_PALETTE)
+            depth = 8;
+        else
+            depth = (colourType & PNG_COLOR_MASK_ALPHA) != 0 ? 32 : 24;
+    }
+
+    if (bitDepth == 16)
+        png_set_strip_16(pngPtr);
+    switch (depth)
+    {
+        case 8:
+            if (colourType != PNG_COLOR_TYPE_PALETTE)
+                throw std::runtime_error("Only paletted PNGs can be read as 8bpp.");
+            png_set_packing(pngPtr);
+            break;
+        case 24:
+        case 32:
+            if (colourType == PNG_COLOR_TYPE_PALETTE)
+                png_set_palette_to_rgb(pngPtr);
+            if ((colourType & PNG_COLOR_MASK_COLOR) == 0)
+            {
+                if (bitDepth < 8)
+                    png_set_expand_gray_1_2_4_to_8(pngPtr);
+                png_set_gray_to_rgb(pngPtr);
+            }
+            if (depth == 24)
+            {
+                png_set_strip_alpha(pngPtr);
+            }
+            else
+            {
+                if (png_get_valid(pngPtr, infoPtr, PNG_INFO_tRNS))
+                    png_set_tRNS_to_alpha(pngPtr);
+                png_set_filler(pngPtr, 0xFF, PNG_FILLER_AFTER);
+            }
+            break;
+        default:
+            throw std::runtime_error("Unsupported depth.");
+    }
+    return depth;
+}
+
+static std::shared_ptr<const Palette> GetPngPalette(png_structp pngPtr, png_infop infoPtr)
+{
+    png_colorp pngPalette{};
+    int paletteSize{};
+    png_get_PLTE(pngPtr, infoPtr, &pngPalette, &paletteSize);
+
+    auto palette = std::make_shared<Palette>();
+    auto colours = palette->Colour;
+    for (auto i = 0; i < paletteSize; i++)
+    {
+        auto& src = pngPalette[i];
+        auto& dst = colours[i];
+        dst.Red = src.red;
+        dst.Green = src.green;
+        dst.Blue = src.blue;
+        dst.Alpha = 255;
+    }
+
+    // Get transparent index
+    png_byte* alphaValues{};
+    int alphaCount{};
+    png_get_tRNS(pngPtr, infoPtr, &alphaValues, &alphaCount, nullptr);
+    for (int i = 0; i < alphaCount; i++)
+    {
+        palette->Colour[i].Alpha = alphaValues[i];
+    }
+    return palette;
+}
+#endif
+
+/**
+ * Rows are decoded directly into the pixels of the returned image rather than into storage
+ * owned by libpng first.
+ */
+Image Image::fromPng(Stream& stream, uint32_t depth)
 {
 #ifdef CS_ENABLE_LIBPNG
-    png_structp pngPtr;
-    png_infop infoPtr;
+    png_structp pngPtr{};
+    png_infop infoPtr{};
+    Image img;
 
     try
     {
@@ -67,109 +156,32 @@ Image Image::fromPng(Stream& stream)
         png_set_read_fn(pngPtr, &stream, PngReadData);
         png_set_sig_bytes(pngPtr, sig_read);
 
-        uint32_t readFlags = PNG_TRANSFORM_STRIP_16 | PNG_TRANSFORM_PACKING;
-        png_read_png(pngPtr, infoPtr, readFlags, nullptr);
-
         // Read header
-        png_uint_32 pngWidth, pngHeight;
-        int bitDepth, colourType, interlaceType;
-        png_get_IHDR(pngPtr, infoPtr, &pngWidth, &pngHeight, &bitDepth, &colourType, &interlaceType, nullptr, nullptr);
-
-        // Read pixels as 32bpp RGBA data
-        auto rowBytes = png_get_rowbytes(pngPtr, infoPtr);
-        auto rowPointers = png_get_rows(pngPtr, infoPtr);
-
-        Image img;
-        img.width = pngWidth;
-        img.height = pngHeight;
-        switch (colourType)
+        png_read_info(pngPtr, infoPtr);
+        img.width = png_get_image_width(pngPtr, infoPtr);
+        img.height = png_get_image_height(pngPtr, infoPtr);
+        img.depth = SetPngTransforms(pngPtr, infoPtr, depth);
+        auto numPasses = png_set_interlace_handling(pngPtr);
+        png_read_update_info(pngPtr, infoPtr);
+
+        img.stride = img.width * (img.depth / 8);
+        if (png_get_rowbytes(pngPtr, infoPtr) != img.stride)
+            throw std::runtime_error("Unexpected row size");
+        if (img.depth == 8)
+            img.palette = GetPngPalette(pngPtr, infoPtr);
+
+        // Read pixels, interlaced images combine each pass into the rows already read
+        img.pixels = std::vector<uint8_t>(static_cast<size_t>(img.stride) * img.height);
+        for (int pass = 0; pass < numPasses; pass++)
         {
-            case PNG_COLOR_TYPE_PALETTE:
-            {
-                // 8-bit paletted or greyscale
-                if (rowBytes != pngWidth)
-                    throw std::runtime_error("Unexpected row size");
-
-                img.depth = 8;
-                img.stride = pngWidth;
-                img.pixels = std::vector<uint8_t>(img.stride * pngHeight);
-
-                // Get palette
-                png_colorp pngPalette{};
-                int paletteSize{};
-                png_get_PLTE(pngPtr, infoPtr, &pngPalette, &paletteSize);
-
-                img.palette = std::make_unique<Palette>();
-                auto colours = img.palette->Colour;
-                for (auto i = 0; i < paletteSize; i++)
-                {
-                    auto& src = pngPalette[i];
-                    auto& dst = colours[i];
-                    dst.Red = src.red;
-                    dst.Green = src.green;
-                    dst.Blue = src.blue;
-                    dst.Alpha = 255;
-                }
-
-                // Get transparent index
-                png_byte* alphaValues{};
-                int alphaCount{};
-                png_get_tRNS(pngPtr, infoPtr, &alphaValues, &alphaCount, nullptr);
-                for (int i = 0; i < alphaCount; i++)
-                {
-                    img.palette->Colour[i].Alpha = alphaValues[i];
-                }
-
-                auto dst = img.pixels.data();
-                for (png_uint_32 i = 0; i < pngHeight; i++)
-                {
-                    std::copy_n(rowPointers[i], rowBytes, dst);
-                    dst += rowBytes;
-                }
-                break;
-            }
-            case PNG_COLOR_TYPE_RGB:
+            auto dst = img.pixels.data();
+            for (uint32_t y = 0; y < img.height; y++)
             {
-                // 24-bit PNG (no alpha)
-                if (rowBytes != pngWidth * 3)
-                    throw std::runtime_error("Unexpected row size");
-
-                img.depth = 24;
-                img.stride = pngWidth * 3;
-                img.pixels = std::vector<uint8_t>(img.stride * pngHeight);
-
-                auto dst = img.pixels.data();
-                for (png_uint_32 i = 0; i < pngHeight; i++)
-                {
-                    auto src = rowPointers[i];
-                    for (png_uint_32 x = 0; x < pngWidth; x++)
-                    {
-                        *dst++ = *src++;
-                        *dst++ = *src++;
-                        *dst++ = *src++;
-                    }
-                }
-                break;
-            }
-            case PNG_COLOR_TYPE_RGBA:
-            {
-                // 32-bit PNG (with alpha)
-                if (rowBytes != pngWidth * 4)
-                    throw std::runtime_error("Unexpected row size");
-
-                img.depth = 32;
-                img.stride = pngWidth * 4;
-                img.pixels = std::vector<uint8_t>(img.stride * pngHeight);
-
-                auto dst = img.pixels.data();
-                for (png_uint_32 i = 0; i < pngHeight; i++)
-                {
-                    std::copy_n(rowPointers[i], rowBytes, dst);
-                    dst += rowBytes;
-                }
-                break;
+                png_read_row(pngPtr, dst, nullptr);
+                dst += img.stride;
             }
         }
+        png_read_end(pngPtr, nullptr);
 
         // Close the PNG
         png_destroy_read_struct(&pngPtr, &infoPtr, nullptr);
@@ -187,11 +199,86 @@ Image Image::fromPng(Stream& stream)
 #endif
 }
 
+PngOptions PngOptions::fast()
+{
+    // For small images, setting up zlib's tables costs more than compressing the pixels
+    PngOptions options;
+    options.compressionLevel = 1;
+    options.memoryLevel = 4;
+    options.filters = PngFilters::none;
+    options.compressText = false;
+    options.trimPalette = true;
+    return options;
+}
+
+/**
+ * Finds the highest palette index used by an 8-bit image. Kept to a plain maximum over each
+ * row so that the compiler can vectorise it.
+ */
+static uint8_t GetHighestIndex(const Image& image)
+{
+    uint8_t highest = 0;
+    for (uint32_t y = 0; y < image.height && highest != 255; y++)
+    {
+        auto row = image.pixels.data() + static_cast<size_t>(y) * image.stride;
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            highest = std::max(highest, row[x]);
+        }
+    }
+    return highest;
+}
+
+#ifdef CS_ENABLE_LIBPNG
+static int GetPngFilters(PngFilters filters)
+{
+    switch (filters)
+    {
+        case PngFilters::none:
+            return PNG_FILTER_NONE;
+        case PngFilters::sub:
+            return PNG_FILTER_SUB;
+        case PngFilters::up:
+            return PNG_FILTER_UP;
+        case PngFilters::average:
+            return PNG_FILTER_AVG;
+        case PngFilters::paeth:
+            return PNG_FILTER_PAETH;
+        case PngFilters::all:
+            return PNG_ALL_FILTERS;
+        default:
+            return -1;
+    }
+}
+
+static int GetZlibStrategy(PngStrategy strategy)
+{
+    switch (strategy)
+    {
+        case PngStrategy::filtered:
+            return Z_FILTERED;
+        case PngStrategy::huffmanOnly:
+            return Z_HUFFMAN_ONLY;
+        case PngStrategy::rle:
+            return Z_RLE;
+        case PngStrategy::fixed:
+            return Z_FIXED;
+        default:
+            return -1;
+    }
+}
+#endif
+
 void Image::toPng(Stream& stream) const
+{
+    toPng(stream, {});
+}
+
+void Image::toPng(Stream& stream, const PngOptions& options) const
 {
 #ifdef CS_ENABLE_LIBPNG
     png_structp pngPtr{};
-    png_colorp pngPalette{};
+    png_infop infoPtr{};
     try
     {
         pngPtr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, PngError, PngWarning);
@@ -200,17 +287,25 @@ void Image::toPng(Stream& stream) const
             throw std::runtime_error("png_create_write_struct failed.");
         }
 
-        png_text pngText[1]{};
-        pngText[0].key = const_cast<char*>("Software");
-        pngText[0].text = const_cast<char*>("libsawyer");
-        pngText[0].compression = PNG_TEXT_COMPRESSION_zTXt;
-
-        auto info_ptr = png_create_info_struct(pngPtr);
-        if (info_ptr == nullptr)
+        infoPtr = png_create_info_struct(pngPtr);
+        if (infoPtr == nullptr)
         {
             throw std::runtime_error("png_create_info_struct failed.");
         }
 
+        // Set error handler
+        if (setjmp(png_jmpbuf(pngPtr)))
+        {
+            throw std::runtime_error("PNG ERROR");
+        }
+
+        png_text pngText[1]{};
+        pngText[0].key = const_cast<char*>("Software");
+        pngText[0].text = const_cast<char*>("libsawyer");
+        pngText[0].compression = options.compressText ? PNG_TEXT_COMPRESSION_zTXt : PNG_TEXT_COMPRESSION_NONE;
+
+        // Write header
+        auto colourType = PNG_COLOR_TYPE_RGB_ALPHA;
         if (depth == 8)
         {
             if (palette == nullptr)
@@ -218,42 +313,45 @@ void Image::toPng(Stream& stream) const
                 throw std::runtime_error("Expected a palette for 8-bit image.");
             }
 
-            // Set the palette
-            pngPalette = static_cast<png_colorp>(png_malloc(pngPtr, PNG_MAX_PALETTE_LENGTH * sizeof(png_color)));
-            if (pngPalette == nullptr)
-            {
-                throw std::runtime_error("png_malloc failed.");
-            }
-            for (size_t i = 0; i < PNG_MAX_PALETTE_LENGTH; i++)
+            // Set the palette, libpng keeps its own copy
+            int paletteLength = PNG_MAX_PALETTE_LENGTH;
+            if (options.trimPalette)
+                paletteLength = GetHighestIndex(*this) + 1;
+            png_color pngPalette[PNG_MAX_PALETTE_LENGTH];
+            for (int i = 0; i < paletteLength; i++)
             {
                 const auto& entry = (*palette)[i];
                 pngPalette[i].blue = entry.Blue;
                 pngPalette[i].green = entry.Green;
                 pngPalette[i].red = entry.Red;
             }
-            png_set_PLTE(pngPtr, info_ptr, pngPalette, PNG_MAX_PALETTE_LENGTH);
-        }
-
-        png_set_write_fn(pngPtr, &stream, PngWriteData, PngFlush);
-
-        // Set error handler
-        if (setjmp(png_jmpbuf(pngPtr)))
-        {
-            throw std::runtime_error("PNG ERROR");
-        }
+            png_set_PLTE(pngPtr, infoPtr, pngPalette, paletteLength);
 
-        // Write header
-        auto colourType = PNG_COLOR_TYPE_RGB_ALPHA;
-        if (depth == 8)
-        {
             png_byte transparentIndex = 0;
-            png_set_tRNS(pngPtr, info_ptr, &transparentIndex, 1, nullptr);
+            png_set_tRNS(pngPtr, infoPtr, &transparentIndex, 1, nullptr);
             colourType = PNG_COLOR_TYPE_PALETTE;
         }
-        png_set_text(pngPtr, info_ptr, pngText, 1);
+        else if (depth != 32)
+        {
+            throw std::runtime_error("Unsupported depth.");
+        }
+
+        png_set_write_fn(pngPtr, &stream, PngWriteData, PngFlush);
+        if (options.compressionLevel != -1)
+            png_set_compression_level(pngPtr, options.compressionLevel);
+        if (options.memoryLevel != -1)
+            png_set_compression_mem_level(pngPtr, options.memoryLevel);
+        auto strategy = GetZlibStrategy(options.strategy);
+        if (strategy != -1)
+            png_set_compression_strategy(pngPtr, strategy);
+        auto filters = GetPngFilters(options.filters);
+        if (filters != -1)
+            png_set_filter(pngPtr, PNG_FILTER_TYPE_BASE, filters);
+
+        png_set_text(pngPtr, infoPtr, pngText, 1);
         png_set_IHDR(
-            pngPtr, info_ptr, width, height, 8, colourType, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-        png_write_info(pngPtr, info_ptr);
+            pngPtr, infoPtr, width, height, 8, colourType, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(pngPtr, infoPtr);
 
         // Write pixels
         auto pixels8 = pixels.data();
@@ -264,14 +362,11 @@ void Image::toPng(Stream& stream) const
         }
 
         png_write_end(pngPtr, nullptr);
-        png_destroy_info_struct(pngPtr, &info_ptr);
-        png_free(pngPtr, pngPalette);
-        png_destroy_write_struct(&pngPtr, nullptr);
+        png_destroy_write_struct(&pngPtr, &infoPtr);
     }
     catch (const std::exception&)
     {
-        png_free(pngPtr, pngPalette);
-        png_destroy_write_struct(&pngPtr, nullptr);
+        png_destroy_write_struct(&pngPtr, &infoPtr);
         throw;
     }
 #else
@@ -279,58 +374,81 @@ void Image::toPng(Stream& stream) const
 #endif
 }
 
-Image Image::crop(int32_t cropX, int32_t cropY, uint32_t cropWidth, uint32_t cropHeight) const
+bool ImageView::contains(int32_t x, int32_t y, uint32_t w, uint32_t h) const
 {
-    auto bytesPerPixel = depth / 8;
-
-    Image dstImage;
-    dstImage.depth = depth;
-    dstImage.width = cropWidth;
-    dstImage.height = cropHeight;
-    dstImage.stride = cropWidth * bytesPerPixel;
-    dstImage.palette = std::make_unique<Palette>(*palette);
+    return x >= 0 && y >= 0 && static_cast<uint64_t>(x) + w <= width && static_cast<uint64_t>(y) + h <= height;
+}
 
-    dstImage.pixels.resize(dstImage.stride * dstImage.height);
+ImageView ImageView::slice(int32_t x, int32_t y, uint32_t w, uint32_t h) const
+{
+    if (!contains(x, y, w, h))
+        throw std::out_of_range("Slice is outside of the image");
+
+    ImageView result = *this;
+    result.pixels = getRow(y) + static_cast<size_t>(x) * (depth / 8);
+    result.width = w;
+    result.height = h;
+    return result;
+}
 
-    const auto* src = pixels.data();
-    auto dst = dstImage.pixels.data();
+ImageView Image::getView() const
+{
+    ImageView view;
+    view.pixels = pixels.data();
+    view.width = width;
+    view.height = height;
+    view.depth = depth;
+    view.stride = stride;
+    view.palette = palette.get();
+    return view;
+}
 
-    size_t srcLineOffset{};
-    size_t dstLineOffset{};
-    auto copyWidth = cropWidth;
-    if (cropX < 0)
-    {
-        dstLineOffset = (-cropX) * bytesPerPixel;
-        copyWidth += cropX;
-    }
-    else
-    {
-        srcLineOffset = cropX * bytesPerPixel;
-    }
-    copyWidth = std::min(copyWidth, width);
-    size_t lineCopyLength = copyWidth * bytesPerPixel;
+static void cropPixels(const ImageView& src, int32_t cropX, int32_t cropY, Image& dstImage)
+{
+    auto bytesPerPixel = src.depth / 8;
+    dstImage.pixels.resize(dstImage.stride * dstImage.height);
 
-    auto copyHeight = cropHeight;
-    if (cropY < 0)
-    {
-        dst += -cropY * stride;
-        copyHeight += cropY;
-    }
-    else
+    // Clip the rectangle to the source image, the rest is left as zeros
+    auto left = std::max<int64_t>(cropX, 0);
+    auto top = std::max<int64_t>(cropY, 0);
+    auto right = std::min<int64_t>(static_cast<int64_t>(cropX) + dstImage.width, src.width);
+    auto bottom = std::min<int64_t>(static_cast<int64_t>(cropY) + dstImage.height, src.height);
+    if (left >= right || top >= bottom)
+        return;
+
+    size_t lineCopyLength = (right - left) * bytesPerPixel;
+    auto dstLineOffset = (left - cropX) * bytesPerPixel;
+    auto dst = dstImage.pixels.data() + (top - cropY) * dstImage.stride;
+    for (auto y = top; y < bottom; y++)
     {
-        src += cropY * stride;
+        auto srcLine = src.getRow(static_cast<uint32_t>(y)) + left * bytesPerPixel;
+        std::memcpy(dst + dstLineOffset, srcLine, lineCopyLength);
+        dst += dstImage.stride;
     }
-    copyHeight = std::min(copyHeight, height);
+}
 
-    for (uint32_t y = 0; y < copyHeight; y++)
-    {
-        auto srcLine = src + srcLineOffset;
-        auto dstLine = dst + dstLineOffset;
-        std::memcpy(dstLine, srcLine, lineCopyLength);
+Image Image::crop(int32_t cropX, int32_t cropY, uint32_t cropWidth, uint32_t cropHeight) const
+{
+    Image dstImage;
+    dstImage.depth = depth;
+    dstImage.width = cropWidth;
+    dstImage.height = cropHeight;
+    dstImage.stride = cropWidth * (depth / 8);
+    dstImage.palette = palette;
+    cropPixels(getView(), cropX, cropY, dstImage);
+    return dstImage;
+}
 
-        src += stride;
-        dst += dstImage.stride;
-    }
+Image Image::crop(const ImageView& src, int32_t cropX, int32_t cropY, uint32_t cropWidth, uint32_t cropHeight)
+{
+    Image dstImage;
+    dstImage.depth = src.depth;
+    dstImage.width = cropWidth;
+    dstImage.height = cropHeight;
+    dstImage.stride = cropWidth * (src.depth / 8);
+    if (src.palette != nullptr)
+        dstImage.palette = std::make_shared<const Palette>(*src.palette);
+    cropPixels(src, cropX, cropY, dstImage);
     return dstImage;
 }
 
@@ -341,10 +459,7 @@ Image Image::copy()
     dstImage.width = width;
     dstImage.height = height;
     dstImage.stride = stride;
-    if (palette)
-    {
-        dstImage.palette = std::make_unique<Palette>(*palette);
-    }
+    dstImage.palette = palette;
     dstImage.pixels = pixels;
 
     return dstImage;
@@ -9,6 +9,74 @@ namespace cs
 {
     class Stream;
 
+    /**
+     * A rectangle of pixels within an image. The pixels are not owned, so a view is only valid
+     * while the image it was taken from is alive and unchanged.
+     */
+    struct ImageView
+    {
+        const uint8_t* pixels{};
+        uint32_t width{};
+        uint32_t height{};
+        uint32_t depth{};
+        uint32_t stride{};
+        const Palette* palette{};
+
+        const uint8_t* getRow(uint32_t y) const
+        {
+            return pixels + static_cast<size_t>(y) * stride;
+        }
+
+        bool contains(int32_t x, int32_t y, uint32_t w, uint32_t h) const;
+
+        /**
+         * Gets a view of a rectangle within this view, without copying any pixels. The rectangle
+         * must be entirely within the view.
+         */
+        ImageView slice(int32_t x, int32_t y, uint32_t w, uint32_t h) const;
+    };
+
+    enum class PngFilters : uint8_t
+    {
+        // Chosen by libpng: none for paletted images, adaptive for others
+        automatic,
+        none,
+        sub,
+        up,
+        average,
+        paeth,
+        all,
+    };
+
+    enum class PngStrategy : uint8_t
+    {
+        automatic,
+        filtered,
+        huffmanOnly,
+        rle,
+        fixed,
+    };
+
+    struct PngOptions
+    {
+        // zlib compression level from 0 to 9, or -1 for the zlib default
+        int32_t compressionLevel = -1;
+
+        // zlib memory level from 1 to 9, lower levels use smaller tables which are quicker to set up
+        int32_t memoryLevel = -1;
+        PngStrategy strategy = PngStrategy::automatic;
+        PngFilters filters = PngFilters::automatic;
+        bool compressText = true;
+
+        // Only write the palette up to the highest index used by an 8-bit image
+        bool trimPalette = false;
+
+        /**
+         * Favours encoding speed over file size, for writing many small images such as sprites.
+         */
+        static PngOptions fast();
+    };
+
     class Image
     {
     public:
@@ -19,12 +87,26 @@ namespace cs
 
         // Data
         std::vector<uint8_t> pixels;
-        std::unique_ptr<Palette> palette;
+
+        // Immutable so it can be shared between images, such as copies and crops
+        std::shared_ptr<const Palette> palette;
         uint32_t stride{};
 
-        static Image fromPng(Stream& stream);
+        /**
+         * @param depth the depth to decode the pixels as: 8 for paletted images, or 24 or 32.
+         *              When 0, the depth closest to the file is used.
+         */
+        static Image fromPng(Stream& stream, uint32_t depth = 0);
         void toPng(Stream& stream) const;
+        void toPng(Stream& stream, const PngOptions& options) const;
+        ImageView getView() const;
+
+        /**
+         * Copies a rectangle of the image into a new image. Any part of the rectangle outside
+         * the image is filled with zeros.
+         */
         Image crop(int32_t cropX, int32_t cropY, uint32_t cropWidth, uint32_t cropHeight) const;
+        static Image crop(const ImageView& src, int32_t cropX, int32_t cropY, uint32_t cropWidth, uint32_t cropHeight);
         Image copy();
     };
 }
@@ -1,11 +1,156 @@
 #include "ImageConverter.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
 
 using namespace cs;
 
-Image ImageConverter::convertTo8bpp(const Image& srcImage, ConvertMode mode, const Palette& palette)
+/**
+ * Remembers the index chosen for each opaque colour during a conversion, as sprite sheets usually
+ * only contain a few hundred distinct colours. Only used without dithering, where the index only
+ * depends on the colour.
+ */
+class ImageConverter::ColourMemo
+{
+private:
+    static constexpr uint32_t capacity = 8192;
+    static constexpr uint32_t maxEntries = capacity / 2;
+
+    // Transparent colours are never added, so an all zero key is free to mark empty slots
+    static constexpr uint32_t emptyKey = 0;
+
+    std::unique_ptr<uint32_t[]> _keys = std::make_unique<uint32_t[]>(capacity);
+    std::unique_ptr<PaletteIndex[]> _values = std::make_unique<PaletteIndex[]>(capacity);
+    uint32_t _numEntries{};
+
+public:
+    uint64_t lookups{};
+    uint64_t hits{};
+
+    template<typename TCompute>
+    PaletteIndex get(const int16_t* colour, TCompute compute)
+    {
+        auto key = static_cast<uint32_t>(colour[0]) | (colour[1] << 8) | (colour[2] << 16) | (static_cast<uint32_t>(colour[3]) << 24);
+        auto slot = ((key * 2654435761u) >> 19) % capacity;
+        lookups++;
+        while (_keys[slot] != emptyKey)
+        {
+            if (_keys[slot] == key)
+            {
+                hits++;
+                return _values[slot];
+            }
+            slot = (slot + 1) % capacity;
+        }
+
+        // Once full, colours are still converted but no longer remembered
+        auto result = compute();
+        if (_numEntries < maxEntries)
+        {
+            _keys[slot] = key;
+            _values[slot] = result;
+            _numEntries++;
+        }
+        return result;
+    }
+};
+
+ImageConverter::ImageConverter(ThreadPool& threadPool)
+    : _threadPool(&threadPool)
+{
+}
+
+ImageConverter::ImageConverter(const Palette& palette, ColourDistance distance)
+    : _boundMatcher(createMatcher(palette, distance))
+{
+}
+
+ImageConverter::ImageConverter(const Palette& palette, ThreadPool& threadPool, ColourDistance distance)
+    : _threadPool(&threadPool)
+    , _boundMatcher(createMatcher(palette, distance))
+{
+}
+
+Image ImageConverter::convertTo8bpp(const Image& srcImage, ConvertMode mode, const Palette& palette, ColourDistance distance)
+{
+    return convertTo8bpp(srcImage.getView(), mode, palette, distance);
+}
+
+Image ImageConverter::convertTo8bpp(const ImageView& srcImage, ConvertMode mode, const Palette& palette, ColourDistance distance)
+{
+    return convert(srcImage, mode, getMatcher(palette, distance), true);
+}
+
+Image ImageConverter::convertTo8bpp(const ImageView& srcImage, ConvertMode mode)
+{
+    return convert(srcImage, mode, getBoundMatcher(), true);
+}
+
+namespace
+{
+    struct ParallelBatch
+    {
+        std::atomic<size_t> nextImage{};
+        std::atomic<size_t> imagesDone{};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+}
+
+/**
+ * Images are claimed by whichever thread is free, including the calling thread, in the same way
+ * as the rows of a single image.
+ */
+std::vector<Image> ImageConverter::convertTo8bpp(stdx::span<const ImageView> srcImages, ConvertMode mode)
 {
-    auto workBuffer = createWorkBuffer(srcImage);
+    const auto& matcher = getBoundMatcher();
+    std::vector<Image> results(srcImages.size());
+    if (_threadPool == nullptr || srcImages.size() <= 1)
+    {
+        for (size_t i = 0; i < srcImages.size(); i++)
+            results[i] = convert(srcImages[i], mode, matcher, true);
+        return results;
+    }
+
+    auto state = std::make_shared<ParallelBatch>();
+    auto run = [this, srcImages, mode, &matcher, &results](ParallelBatch& batch) {
+        for (auto i = batch.nextImage++; i < srcImages.size(); i = batch.nextImage++)
+        {
+            try
+            {
+                results[i] = convert(srcImages[i], mode, matcher, false);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(batch.errorMutex);
+                if (!batch.error)
+                    batch.error = std::current_exception();
+            }
+            batch.imagesDone++;
+        }
+    };
+
+    auto numHelpers = std::min(_threadPool->getNumThreads(), srcImages.size() - 1);
+    for (size_t i = 0; i < numHelpers; i++)
+    {
+        _threadPool->enqueue([state, run]() { run(*state); });
+    }
+
+    run(*state);
+    while (state->imagesDone.load(std::memory_order_acquire) != srcImages.size())
+        std::this_thread::yield();
 
+    if (state->error)
+        std::rethrow_exception(state->error);
+    return results;
+}
+
+Image ImageConverter::convert(const ImageView& srcImage, ConvertMode mode, const std::shared_ptr<const PaletteMatcher>& matcher, bool allowParallel)
+{
     Image dstImage;
     dstImage.depth = 8;
     dstImage.width = srcImage.width;
@@ -13,91 +158,322 @@ Image ImageConverter::convertTo8bpp(const Image& srcImage, ConvertMode mode, con
     dstImage.stride = dstImage.width;
     dstImage.pixels.resize(dstImage.stride * dstImage.height);
 
-    auto* src = workBuffer.get();
+    auto width = srcImage.width;
+    auto height = srcImage.height;
     auto* dst = dstImage.pixels.data();
-    for (uint32_t y = 0; y < srcImage.height; y++)
+    if (allowParallel && _threadPool != nullptr && height > 1 && static_cast<uint64_t>(width) * height >= minParallelPixels)
     {
-        for (uint32_t x = 0; x < srcImage.width; x++)
+        convertRowsParallel(mode, matcher, srcImage, dst);
+    }
+    else if (mode == ConvertMode::Dithering)
+    {
+        // The row being converted, followed by the row below which receives some of its error
+        auto rows = std::make_unique<int16_t[]>(static_cast<size_t>(width) * 8);
+        auto* nextRow = rows.get() + width * 4;
+        for (uint32_t y = 0; y < height; y++)
         {
-            *dst++ = calculatePaletteIndex(mode, palette, src, x, y, srcImage.width, srcImage.height);
-            src += 4;
+            if (y == 0)
+                loadRow(srcImage, 0, rows.get());
+            if (y + 1 < height)
+                loadRow(srcImage, y + 1, nextRow);
+            convertRow(mode, *matcher, rows.get(), dst + static_cast<size_t>(y) * width, y, 0, width, width, height);
+            std::memcpy(rows.get(), nextRow, width * 4 * sizeof(int16_t));
         }
     }
-
+    else
+    {
+        // Without dithering, each pixel is converted independently
+        auto row = std::make_unique<int16_t[]>(static_cast<size_t>(width) * 4);
+        ColourMemo memo;
+        for (uint32_t y = 0; y < height; y++)
+        {
+            loadRow(srcImage, y, row.get());
+            convertRow(mode, *matcher, row.get(), dst + static_cast<size_t>(y) * width, y, width, height, memo);
+        }
+        _memoLookups += memo.lookups;
+        _memoHits += memo.hits;
+    }
     return dstImage;
 }
 
-std::unique_ptr<int16_t[]> ImageConverter::createWorkBuffer(const Image& srcImage)
+namespace
 {
-    // Create an RGBA buffer (64-bit colour, 2 bytes per RGBA component)
-    auto workBuffer = std::make_unique<int16_t[]>(srcImage.width * srcImage.height * 4);
+    struct ParallelRows
+    {
+        // A row can convert pixels as long as the row above has converted this many pixels ahead
+        // of them. Dithering the pixels before that reads and writes the pixels below it.
+        static constexpr uint32_t lag = 3;
 
-    const auto* src = srcImage.pixels.data();
-    auto* dst = workBuffer.get();
-    auto padding = srcImage.stride - (srcImage.width * (srcImage.depth / 8));
-    for (uint32_t y = 0; y < srcImage.height; y++)
+        // Progress is published in chunks to limit contention between rows
+        static constexpr uint32_t chunkSize = 64;
+
+        std::shared_ptr<const PaletteMatcher> matcher;
+        ImageConverter::ConvertMode mode{};
+        ImageView srcImage;
+        std::unique_ptr<int16_t[]> workBuffer;
+        uint8_t* dst{};
+        std::atomic<uint32_t> nextRow{};
+        std::atomic<uint32_t> rowsDone{};
+        std::unique_ptr<std::atomic<uint32_t>[]> progress;
+        std::atomic<uint64_t> memoLookups{};
+        std::atomic<uint64_t> memoHits{};
+        std::atomic<bool> failed{};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+}
+
+/**
+ * Rows are claimed in order by whichever thread is free, so a thread only ever waits for rows
+ * which have already been claimed by a running thread. Pool threads which start after every row
+ * has been claimed return without touching the image, so the caller does not wait for them.
+ * Dithering needs the whole image loaded up front, as any number of rows can be in progress.
+ * Every claimed row is counted as done even if it fails, so the caller always waits for the
+ * other threads to finish with the image before rethrowing the first error.
+ */
+void ImageConverter::convertRowsParallel(ConvertMode mode, const std::shared_ptr<const PaletteMatcher>& matcher, const ImageView& srcImage, uint8_t* dst)
+{
+    auto height = srcImage.height;
+    auto state = std::make_shared<ParallelRows>();
+    state->matcher = matcher;
+    state->mode = mode;
+    state->srcImage = srcImage;
+    state->dst = dst;
+    if (mode == ConvertMode::Dithering)
     {
-        for (uint32_t x = 0; x < srcImage.width; x++)
+        state->workBuffer = createWorkBuffer(srcImage);
+        state->progress = std::make_unique<std::atomic<uint32_t>[]>(height);
+        for (uint32_t y = 0; y < height; y++)
+            state->progress[y] = 0;
+    }
+
+    auto run = [](ParallelRows& rows) {
+        auto width = rows.srcImage.width;
+        auto height = rows.srcImage.height;
+
+        // Buffers are allocated once a row has been claimed, so that a failed allocation is
+        // handled like any other error in that row
+        std::unique_ptr<int16_t[]> row;
+        std::unique_ptr<ColourMemo> memo;
+        for (auto y = rows.nextRow++; y < height; y = rows.nextRow++)
         {
-            int16_t r, g, b, a;
-            if (srcImage.depth == 8)
+            try
             {
-                auto srcIndex = *src++;
-                auto srcPixel = srcImage.palette->Colour[srcIndex];
-                r = srcPixel.Red;
-                g = srcPixel.Green;
-                b = srcPixel.Blue;
-                a = srcPixel.Alpha;
-            }
-            else if (srcImage.depth == 24)
-            {
-                r = *src++;
-                g = *src++;
-                b = *src++;
-                a = 255;
+                if (rows.failed.load(std::memory_order_relaxed))
+                {
+                    // Remaining rows are only counted as done once any row has failed
+                }
+                else if (rows.mode != ConvertMode::Dithering)
+                {
+                    if (row == nullptr)
+                    {
+                        row = std::make_unique<int16_t[]>(static_cast<size_t>(width) * 4);
+                        memo = std::make_unique<ColourMemo>();
+                    }
+                    loadRow(rows.srcImage, y, row.get());
+                    convertRow(rows.mode, *rows.matcher, row.get(), rows.dst + static_cast<size_t>(y) * width, y, width, height, *memo);
+
+                    // Statistics are added per row as the caller may return as soon as the last row is done
+                    rows.memoLookups += memo->lookups;
+                    rows.memoHits += memo->hits;
+                    memo->lookups = 0;
+                    memo->hits = 0;
+                }
+                else
+                {
+                    auto* ditherRow = rows.workBuffer.get() + static_cast<size_t>(y) * width * 4;
+                    uint32_t x = 0;
+                    while (x < width)
+                    {
+                        auto end = std::min(x + ParallelRows::chunkSize, width);
+                        if (y > 0)
+                        {
+                            uint32_t above;
+                            while ((above = rows.progress[y - 1].load(std::memory_order_acquire)) < std::min(x + ParallelRows::lag, width))
+                                std::this_thread::yield();
+                            if (above != width)
+                                end = std::min(end, above - ParallelRows::lag + 1);
+                        }
+                        convertRow(rows.mode, *rows.matcher, ditherRow, rows.dst + static_cast<size_t>(y) * width, y, x, end, width, height);
+                        x = end;
+                        rows.progress[y].store(x, std::memory_order_release);
+                    }
+                }
             }
-            else if (srcImage.depth == 32)
+            catch (...)
             {
-                r = *src++;
-                g = *src++;
-                b = *src++;
-                a = *src++;
+                std::lock_guard<std::mutex> lock(rows.errorMutex);
+                if (!rows.error)
+                    rows.error = std::current_exception();
+                rows.failed = true;
             }
-            *dst++ = r;
-            *dst++ = g;
-            *dst++ = b;
-            *dst++ = a;
+
+            // The row below may be waiting for this one, even if it failed
+            if (rows.progress != nullptr)
+                rows.progress[y].store(width, std::memory_order_release);
+            rows.rowsDone++;
         }
+    };
+
+    auto numHelpers = std::min<size_t>(_threadPool->getNumThreads(), height - 1);
+    for (size_t i = 0; i < numHelpers; i++)
+    {
+        _threadPool->enqueue([state, run]() { run(*state); });
+    }
+
+    run(*state);
+    while (state->rowsDone.load(std::memory_order_acquire) != height)
+        std::this_thread::yield();
+
+    if (state->error)
+        std::rethrow_exception(state->error);
+    _memoLookups += state->memoLookups;
+    _memoHits += state->memoHits;
+}
+
+/**
+ * Converts [xBegin, xEnd) of a row. When dithering, the row below must follow the row in memory.
+ */
+void ImageConverter::convertRow(ConvertMode mode, const PaletteMatcher& matcher, int16_t* row, uint8_t* dst, uint32_t y, uint32_t xBegin, uint32_t xEnd, uint32_t width, uint32_t height)
+{
+    auto* src = row + xBegin * 4;
+    dst += xBegin;
+    for (auto x = xBegin; x < xEnd; x++)
+    {
+        *dst++ = calculatePaletteIndex(mode, matcher, src, x, y, width, height);
+        src += 4;
+    }
+}
+
+void ImageConverter::convertRow(ConvertMode mode, const PaletteMatcher& matcher, int16_t* row, uint8_t* dst, uint32_t y, uint32_t width, uint32_t height, ColourMemo& memo)
+{
+    auto* src = row;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        if (isTransparentPixel(src))
+            *dst++ = TransparentIndex;
+        else
+            *dst++ = memo.get(src, [&]() { return calculatePaletteIndex(mode, matcher, src, x, y, width, height); });
+        src += 4;
+    }
+}
 
-        // Skip any padding
-        src += padding;
+ImageConverter::Statistics ImageConverter::getStatistics() const
+{
+    Statistics result;
+    result.memoLookups = _memoLookups;
+    result.memoHits = _memoHits;
+    return result;
+}
+
+void ImageConverter::resetStatistics()
+{
+    _memoLookups = 0;
+    _memoHits = 0;
+}
+
+std::shared_ptr<const PaletteMatcher> ImageConverter::getMatcher(const Palette& palette, ColourDistance distance)
+{
+    std::lock_guard<std::mutex> lock(_matcherMutex);
+    if (_matcher == nullptr || _matcher->getDistance() != distance || std::memcmp(&_matcher->getPalette(), &palette, sizeof(Palette)) != 0)
+    {
+        _matcher = createMatcher(palette, distance);
     }
+    return _matcher;
+}
+
+const std::shared_ptr<const PaletteMatcher>& ImageConverter::getBoundMatcher() const
+{
+    if (_boundMatcher == nullptr)
+        throw std::runtime_error("Image converter is not bound to a palette");
+    return _boundMatcher;
+}
+
+std::shared_ptr<const PaletteMatcher> ImageConverter::createMatcher(const Palette& palette, ColourDistance distance)
+{
+    // Only entries without a special purpose can be chosen for colours not in the palette
+    static const auto candidates = []() {
+        std::bitset<PaletteSize> result;
+        for (int32_t i = 0; i < PaletteSize; i++)
+            result[i] = isChangablePixel(i);
+        return result;
+    }();
+    return std::make_shared<const PaletteMatcher>(palette, candidates, distance);
+}
+
+std::unique_ptr<int16_t[]> ImageConverter::createWorkBuffer(const ImageView& srcImage)
+{
+    // Create an RGBA buffer (64-bit colour, 2 bytes per RGBA component)
+    auto rowLength = static_cast<size_t>(srcImage.width) * 4;
+    auto workBuffer = std::make_unique<int16_t[]>(rowLength * srcImage.height);
+    for (uint32_t y = 0; y < srcImage.height; y++)
+        loadRow(srcImage, y, workBuffer.get() + y * rowLength);
     return workBuffer;
 }
 
-PaletteIndex ImageConverter::calculatePaletteIndex(ConvertMode mode, const Palette& palette, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+/**
+ * Reads a row of the image as RGBA with 2 bytes per component, leaving room for dithering error.
+ */
+void ImageConverter::loadRow(const ImageView& srcImage, uint32_t y, int16_t* dst)
+{
+    const auto* src = srcImage.getRow(y);
+    for (uint32_t x = 0; x < srcImage.width; x++)
+    {
+        int16_t r, g, b, a;
+        if (srcImage.depth == 8)
+        {
+            auto srcIndex = *src++;
+            auto srcPixel = srcImage.palette->Colour[srcIndex];
+            r = srcPixel.Red;
+            g = srcPixel.Green;
+            b = srcPixel.Blue;
+            a = srcPixel.Alpha;
+        }
+        else if (srcImage.depth == 24)
+        {
+            r = *src++;
+            g = *src++;
+            b = *src++;
+            a = 255;
+        }
+        else if (srcImage.depth == 32)
+        {
+            r = *src++;
+            g = *src++;
+            b = *src++;
+            a = *src++;
+        }
+        *dst++ = r;
+        *dst++ = g;
+        *dst++ = b;
+        *dst++ = a;
+    }
+}
+
+PaletteIndex ImageConverter::calculatePaletteIndex(ConvertMode mode, const PaletteMatcher& matcher, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
 {
     if (isTransparentPixel(rgbaSrc))
         return TransparentIndex;
 
-    auto paletteIndex = getPaletteIndex(palette, rgbaSrc);
+    auto paletteIndex = getPaletteIndex(matcher, rgbaSrc);
     if (mode != ConvertMode::Default && paletteIndex == TransparentIndex)
     {
         if (mode == ConvertMode::Dithering)
         {
-            paletteIndex = dither(palette, rgbaSrc, x, y, width, height);
+            paletteIndex = dither(matcher, rgbaSrc, x, y, width, height);
         }
         else if (mode == ConvertMode::Closest)
         {
-            paletteIndex = getClosestPaletteIndex(palette, rgbaSrc);
+            paletteIndex = getClosestPaletteIndex(matcher, rgbaSrc);
         }
     }
     return paletteIndex;
 }
 
-PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+PaletteIndex ImageConverter::dither(const PaletteMatcher& matcher, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
 {
-    auto paletteIndex = getClosestPaletteIndex(palette, rgbaSrc);
+    const auto& palette = matcher.getPalette();
+    auto paletteIndex = getClosestPaletteIndex(matcher, rgbaSrc);
     auto dr = rgbaSrc[0] - static_cast<int16_t>(palette[paletteIndex].Red);
     auto dg = rgbaSrc[1] - static_cast<int16_t>(palette[paletteIndex].Green);
     auto db = rgbaSrc[2] - static_cast<int16_t>(palette[paletteIndex].Blue);
@@ -107,8 +483,8 @@ PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, ui
 
     if (x + 1 < width)
     {
-        if (!isInPalette(palette, rgbaSrc + 4)
-            && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(palette, rgbaSrc + 4)))
+        if (!isInPalette(matcher, rgbaSrc + 4)
+            && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(matcher, rgbaSrc + 4)))
         {
             // Right
             rgbaSrc[4] += dr * 7 / 16;
@@ -121,8 +497,8 @@ PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, ui
     {
         if (x > 0)
         {
-            if (!isInPalette(palette, rgbaSrc + 4 * (width - 1))
-                && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(palette, rgbaSrc + 4 * (width - 1))))
+            if (!isInPalette(matcher, rgbaSrc + 4 * (width - 1))
+                && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(matcher, rgbaSrc + 4 * (width - 1))))
             {
                 // Bottom left
                 rgbaSrc[4 * (width - 1)] += dr * 3 / 16;
@@ -132,8 +508,8 @@ PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, ui
         }
 
         // Bottom
-        if (!isInPalette(palette, rgbaSrc + 4 * width)
-            && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(palette, rgbaSrc + 4 * width)))
+        if (!isInPalette(matcher, rgbaSrc + 4 * width)
+            && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(matcher, rgbaSrc + 4 * width)))
         {
             rgbaSrc[4 * width] += dr * 5 / 16;
             rgbaSrc[4 * width + 1] += dg * 5 / 16;
@@ -142,8 +518,8 @@ PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, ui
 
         if (x + 1 < width)
         {
-            if (!isInPalette(palette, rgbaSrc + 4 * (width + 1))
-                && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(palette, rgbaSrc + 4 * (width + 1))))
+            if (!isInPalette(matcher, rgbaSrc + 4 * (width + 1))
+                && thisIndexType == getPaletteIndexType(getClosestPaletteIndex(matcher, rgbaSrc + 4 * (width + 1))))
             {
                 // Bottom right
                 rgbaSrc[4 * (width + 1)] += dr * 1 / 16;
@@ -156,22 +532,18 @@ PaletteIndex ImageConverter::dither(const Palette& palette, int16_t* rgbaSrc, ui
     return paletteIndex;
 }
 
-bool ImageConverter::isInPalette(const Palette& palette, int16_t* colour)
+bool ImageConverter::isInPalette(const PaletteMatcher& matcher, int16_t* colour)
 {
-    return !(getPaletteIndex(palette, colour) == TransparentIndex && !isTransparentPixel(colour));
+    return !(getPaletteIndex(matcher, colour) == TransparentIndex && !isTransparentPixel(colour));
 }
 
-PaletteIndex ImageConverter::getPaletteIndex(const Palette& palette, int16_t* colour)
+PaletteIndex ImageConverter::getPaletteIndex(const PaletteMatcher& matcher, int16_t* colour)
 {
     if (!isTransparentPixel(colour))
     {
-        for (int32_t i = 0; i < PaletteSize; i++)
-        {
-            if (static_cast<int16_t>(palette[i].Red) == colour[0] && static_cast<int16_t>(palette[i].Green) == colour[1] && static_cast<int16_t>(palette[i].Blue) == colour[2])
-            {
-                return i;
-            }
-        }
+        auto index = matcher.findExact(colour[0], colour[1], colour[2]);
+        if (index)
+            return *index;
     }
     return TransparentIndex;
 }
@@ -181,27 +553,9 @@ bool ImageConverter::isTransparentPixel(const int16_t* colour)
     return colour[3] < 128;
 }
 
-PaletteIndex ImageConverter::getClosestPaletteIndex(const Palette& palette, const int16_t* colour)
+PaletteIndex ImageConverter::getClosestPaletteIndex(const PaletteMatcher& matcher, const int16_t* colour)
 {
-    auto smallestError = static_cast<uint32_t>(-1);
-    auto bestMatch = TransparentIndex;
-    for (int32_t x = 0; x < PaletteSize; x++)
-    {
-        if (isChangablePixel(x))
-        {
-            uint32_t error = (static_cast<int16_t>(palette[x].Red) - colour[0])
-                    * (static_cast<int16_t>(palette[x].Red) - colour[0])
-                + (static_cast<int16_t>(palette[x].Green) - colour[1]) * (static_cast<int16_t>(palette[x].Green) - colour[1])
-                + (static_cast<int16_t>(palette[x].Blue) - colour[2]) * (static_cast<int16_t>(palette[x].Blue) - colour[2]);
-
-            if (smallestError == static_cast<uint32_t>(-1) || smallestError > error)
-            {
-                bestMatch = x;
-                smallestError = error;
-            }
-        }
-    }
-    return bestMatch;
+    return matcher.findClosest(colour[0], colour[1], colour[2]);
 }
 
 /**
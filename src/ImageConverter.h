@@ -2,16 +2,39 @@
 
 #include "Image.h"
 #include "Palette.h"
+#include "PaletteMatcher.h"
+#include "Span.hpp"
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace cs
 {
+    class ThreadPool;
+
     class ImageConverter
     {
     private:
         static constexpr PaletteIndex TransparentIndex = 0;
 
+        // Smaller images are not worth splitting between threads
+        static constexpr uint32_t minParallelPixels = 128 * 128;
+
+        ThreadPool* _threadPool{};
+
+        class ColourMemo;
+        std::atomic<uint64_t> _memoLookups{};
+        std::atomic<uint64_t> _memoHits{};
+
+        // The matcher for the most recently used palette, which is reused while the palette and distance are unchanged
+        std::mutex _matcherMutex;
+        std::shared_ptr<const PaletteMatcher> _matcher;
+
+        // The matcher for the palette the converter was constructed with, never replaced
+        std::shared_ptr<const PaletteMatcher> _boundMatcher;
+
     public:
         enum class ConvertMode
         {
@@ -29,16 +52,73 @@ namespace cs
             special,
         };
 
-        Image convertTo8bpp(const Image& src, ConvertMode mode, const Palette& palette);
+        /**
+         * Without dithering, the index chosen for each opaque colour is remembered for the rest of
+         * the conversion. These count how often that was reused, across all conversions.
+         */
+        struct Statistics
+        {
+            uint64_t memoLookups{};
+            uint64_t memoHits{};
+        };
+
+        ImageConverter() = default;
+
+        /**
+         * Large images are converted using the threads of the pool as well as the calling thread.
+         * Dithered output is identical to converting on a single thread.
+         */
+        ImageConverter(ThreadPool& threadPool);
+
+        /**
+         * Binds the converter to a palette. Everything derived from the palette is computed once
+         * here, so the overloads without a palette can convert any number of images, from any
+         * number of threads, without repeating that work or taking a lock.
+         */
+        ImageConverter(const Palette& palette, ColourDistance distance = ColourDistance::rgb);
+        ImageConverter(const Palette& palette, ThreadPool& threadPool, ColourDistance distance = ColourDistance::rgb);
+
+        /**
+         * @param distance how the closest palette entry is chosen for colours not in the palette.
+         */
+        Image convertTo8bpp(const Image& src, ConvertMode mode, const Palette& palette, ColourDistance distance = ColourDistance::rgb);
+
+        /**
+         * Converts the pixels of a view, such as a single sprite within a sheet, without
+         * copying them out of the source image first.
+         */
+        Image convertTo8bpp(const ImageView& src, ConvertMode mode, const Palette& palette, ColourDistance distance = ColourDistance::rgb);
+
+        /**
+         * Converts to the palette the converter is bound to.
+         */
+        Image convertTo8bpp(const ImageView& src, ConvertMode mode);
+
+        /**
+         * Converts each image to the palette the converter is bound to. With a thread pool, the
+         * images are converted concurrently, each one on a single thread.
+         */
+        std::vector<Image> convertTo8bpp(stdx::span<const ImageView> srcImages, ConvertMode mode);
+
+        Statistics getStatistics() const;
+        void resetStatistics();
 
     private:
-        static std::unique_ptr<int16_t[]> createWorkBuffer(const Image& srcImage);
-        static PaletteIndex calculatePaletteIndex(ConvertMode mode, const Palette& palette, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
-        static PaletteIndex dither(const Palette& palette, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
-        static bool isInPalette(const Palette& palette, int16_t* colour);
-        static PaletteIndex getPaletteIndex(const Palette& palette, int16_t* colour);
+        std::shared_ptr<const PaletteMatcher> getMatcher(const Palette& palette, ColourDistance distance);
+        const std::shared_ptr<const PaletteMatcher>& getBoundMatcher() const;
+        static std::shared_ptr<const PaletteMatcher> createMatcher(const Palette& palette, ColourDistance distance);
+        Image convert(const ImageView& srcImage, ConvertMode mode, const std::shared_ptr<const PaletteMatcher>& matcher, bool allowParallel);
+        static std::unique_ptr<int16_t[]> createWorkBuffer(const ImageView& srcImage);
+        static void loadRow(const ImageView& srcImage, uint32_t y, int16_t* dst);
+        void convertRowsParallel(ConvertMode mode, const std::shared_ptr<const PaletteMatcher>& matcher, const ImageView& srcImage, uint8_t* dst);
+        static void convertRow(ConvertMode mode, const PaletteMatcher& matcher, int16_t* row, uint8_t* dst, uint32_t y, uint32_t xBegin, uint32_t xEnd, uint32_t width, uint32_t height);
+        static void convertRow(ConvertMode mode, const PaletteMatcher& matcher, int16_t* row, uint8_t* dst, uint32_t y, uint32_t width, uint32_t height, ColourMemo& memo);
+        static PaletteIndex calculatePaletteIndex(ConvertMode mode, const PaletteMatcher& matcher, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+        static PaletteIndex dither(const PaletteMatcher& matcher, int16_t* rgbaSrc, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+        static bool isInPalette(const PaletteMatcher& matcher, int16_t* colour);
+        static PaletteIndex getPaletteIndex(const PaletteMatcher& matcher, int16_t* colour);
         static bool isTransparentPixel(const int16_t* colour);
-        static PaletteIndex getClosestPaletteIndex(const Palette& palette, const int16_t* colour);
+        static PaletteIndex getClosestPaletteIndex(const PaletteMatcher& matcher, const int16_t* colour);
         static bool isChangablePixel(PaletteIndex paletteIndex);
         static PaletteIndexType getPaletteIndexType(PaletteIndex paletteIndex);
     };
@@ -0,0 +1,106 @@
+#include "MemoryMappedFile.h"
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cs;
+
+MemoryMappedFile::MemoryMappedFile(const fs::path& path)
+{
+    auto exceptionOpenError = "Failed to open '" + path.u8string() + "' for reading";
+#ifdef _WIN32
+    auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(exceptionOpenError);
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        throw std::runtime_error(exceptionOpenError);
+    }
+    _len = static_cast<size_t>(size.QuadPart);
+
+    // Empty files can not be mapped
+    if (_len != 0)
+    {
+        // The mapping keeps the file open, so the handle is no longer needed
+        _mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (_mapping == nullptr)
+            throw std::runtime_error(exceptionOpenError);
+
+        _data = static_cast<const std::byte*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (_data == nullptr)
+        {
+            CloseHandle(_mapping);
+            throw std::runtime_error(exceptionOpenError);
+        }
+    }
+    else
+    {
+        CloseHandle(file);
+    }
+#else
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error(exceptionOpenError);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error(exceptionOpenError);
+    }
+    _len = static_cast<size_t>(st.st_size);
+
+    // Empty files can not be mapped
+    if (_len != 0)
+    {
+        auto data = ::mmap(nullptr, _len, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error(exceptionOpenError);
+        _data = static_cast<const std::byte*>(data);
+    }
+    else
+    {
+        ::close(fd);
+    }
+#endif
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+#ifdef _WIN32
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+    if (_mapping != nullptr)
+        CloseHandle(_mapping);
+#else
+    if (_data != nullptr)
+        ::munmap(const_cast<std::byte*>(_data), _len);
+#endif
+}
+
+const std::byte* MemoryMappedFile::data() const
+{
+    return _data;
+}
+
+size_t MemoryMappedFile::size() const
+{
+    return _len;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FileSystem.hpp"
+#include "Span.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace cs
+{
+    /**
+     * A read-only view of a whole file mapped into memory. Pages are only read from disk when they
+     * are first accessed, so opening large files is cheap. The file must not be modified while
+     * it is mapped.
+     */
+    class MemoryMappedFile
+    {
+    private:
+        const std::byte* _data{};
+        size_t _len{};
+#ifdef _WIN32
+        void* _mapping{};
+#endif
+
+    public:
+        MemoryMappedFile(const fs::path& path);
+        MemoryMappedFile(const MemoryMappedFile&) = delete;
+        MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+        ~MemoryMappedFile();
+
+        const std::byte* data() const;
+        size_t size() const;
+
+        stdx::span<const std::byte> getSpan() const
+        {
+            return stdx::span<const std::byte>(_data, _len);
+        }
+    };
+}
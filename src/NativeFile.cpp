@@ -0,0 +1,255 @@
+#include "NativeFile.h"
+#include "Stream.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cs;
+
+constexpr const char* exceptionReadError = "Failed to read data";
+constexpr const char* exceptionWriteError = "Failed to write data";
+
+NativeFile::NativeFile(const fs::path& path, uint8_t flags)
+{
+#ifdef _WIN32
+    if (flags & StreamFlags::write)
+        _handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    else
+        _handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    auto success = _handle != INVALID_HANDLE_VALUE;
+#else
+    if (flags & StreamFlags::write)
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    else
+        _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    auto success = _fd != -1;
+#endif
+    if (!success)
+    {
+        if (flags & StreamFlags::write)
+            throw std::runtime_error("Failed to open '" + path.u8string() + "' for writing");
+        else
+            throw std::runtime_error("Failed to open '" + path.u8string() + "' for reading");
+    }
+}
+
+NativeFile::~NativeFile()
+{
+#ifdef _WIN32
+    CloseHandle(_handle);
+#else
+    ::close(_fd);
+#endif
+}
+
+uint64_t NativeFile::getSize() const
+{
+#ifdef _WIN32
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(_handle, &size))
+        throw std::runtime_error(exceptionReadError);
+    return static_cast<uint64_t>(size.QuadPart);
+#else
+    struct stat st;
+    if (::fstat(_fd, &st) != 0)
+        throw std::runtime_error(exceptionReadError);
+    return static_cast<uint64_t>(st.st_size);
+#endif
+}
+
+void NativeFile::read(void* buffer, size_t len)
+{
+    auto dst = static_cast<std::byte*>(buffer);
+    while (len != 0)
+    {
+#ifdef _WIN32
+        DWORD readLen{};
+        auto chunkLen = static_cast<DWORD>(std::min<size_t>(len, 0x40000000));
+        if (!ReadFile(_handle, dst, chunkLen, &readLen, nullptr) || readLen == 0)
+            throw std::runtime_error(exceptionReadError);
+#else
+        auto readLen = ::read(_fd, dst, len);
+        if (readLen < 0 && errno == EINTR)
+            continue;
+        if (readLen <= 0)
+            throw std::runtime_error(exceptionReadError);
+#endif
+        dst += readLen;
+        len -= readLen;
+    }
+}
+
+void NativeFile::write(const void* buffer, size_t len)
+{
+    auto src = static_cast<const std::byte*>(buffer);
+    while (len != 0)
+    {
+#ifdef _WIN32
+        DWORD writtenLen{};
+        auto chunkLen = static_cast<DWORD>(std::min<size_t>(len, 0x40000000));
+        if (!WriteFile(_handle, src, chunkLen, &writtenLen, nullptr) || writtenLen == 0)
+            throw std::runtime_error(exceptionWriteError);
+#else
+        auto writtenLen = ::write(_fd, src, len);
+        if (writtenLen < 0 && errno == EINTR)
+            continue;
+        if (writtenLen <= 0)
+            throw std::runtime_error(exceptionWriteError);
+#endif
+        src += writtenLen;
+        len -= writtenLen;
+    }
+}
+
+void NativeFile::readAt(uint64_t offset, void* buffer, size_t len)
+{
+    auto dst = static_cast<std::byte*>(buffer);
+    while (len != 0)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD readLen{};
+        auto chunkLen = static_cast<DWORD>(std::min<size_t>(len, 0x40000000));
+        if (!ReadFile(_handle, dst, chunkLen, &readLen, &overlapped) || readLen == 0)
+            throw std::runtime_error(exceptionReadError);
+#else
+        auto readLen = ::pread(_fd, dst, len, static_cast<off_t>(offset));
+        if (readLen < 0 && errno == EINTR)
+            continue;
+        if (readLen <= 0)
+            throw std::runtime_error(exceptionReadError);
+#endif
+        dst += readLen;
+        offset += readLen;
+        len -= readLen;
+    }
+}
+
+void NativeFile::writeAt(uint64_t offset, const void* buffer, size_t len)
+{
+    auto src = static_cast<const std::byte*>(buffer);
+    while (len != 0)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD writtenLen{};
+        auto chunkLen = static_cast<DWORD>(std::min<size_t>(len, 0x40000000));
+        if (!WriteFile(_handle, src, chunkLen, &writtenLen, &overlapped) || writtenLen == 0)
+            throw std::runtime_error(exceptionWriteError);
+#else
+        auto writtenLen = ::pwrite(_fd, src, len, static_cast<off_t>(offset));
+        if (writtenLen < 0 && errno == EINTR)
+            continue;
+        if (writtenLen <= 0)
+            throw std::runtime_error(exceptionWriteError);
+#endif
+        src += writtenLen;
+        offset += writtenLen;
+        len -= writtenLen;
+    }
+}
+
+void NativeFile::sync()
+{
+#ifdef _WIN32
+    auto success = FlushFileBuffers(_handle) != 0;
+#else
+    auto success = ::fsync(_fd) == 0;
+#endif
+    if (!success)
+        throw std::runtime_error(exceptionWriteError);
+}
+
+void NativeFile::sync(const fs::path& path)
+{
+#ifdef _WIN32
+    auto handle = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error(exceptionWriteError);
+    auto success = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+#else
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error(exceptionWriteError);
+    auto success = ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+    if (!success)
+        throw std::runtime_error(exceptionWriteError);
+}
+
+void NativeFile::copyPermissions(const fs::path& path)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return;
+
+    // Only privileged users can give a file away, so failing to keep the owner is not an error.
+    // The owner is changed first as it may clear the set-user-ID bit.
+    [[maybe_unused]] auto ownerResult = ::fchown(_fd, st.st_uid, st.st_gid);
+    if (::fchmod(_fd, st.st_mode & 07777) != 0)
+        throw std::runtime_error(exceptionWriteError);
+#endif
+}
+
+fs::path NativeFile::resolveTarget(const fs::path& path)
+{
+    std::error_code ec;
+    auto result = fs::weakly_canonical(path, ec);
+    return ec ? path : result;
+}
+
+fs::path NativeFile::getTemporaryPath(const fs::path& path)
+{
+    static std::atomic<uint32_t> counter;
+#ifdef _WIN32
+    auto processId = static_cast<uint32_t>(GetCurrentProcessId());
+#else
+    auto processId = static_cast<uint32_t>(::getpid());
+#endif
+    auto name = path.filename().u8string() + "." + std::to_string(processId) + "." + std::to_string(counter++) + ".tmp";
+    return path.parent_path() / fs::u8path(name);
+}
+
+void NativeFile::replace(const fs::path& srcPath, const fs::path& dstPath)
+{
+#ifdef _WIN32
+    // ReplaceFileW keeps the attributes and ACLs of the replaced file but fails if it does not exist
+    if (ReplaceFileW(dstPath.c_str(), srcPath.c_str(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr))
+        return;
+    if (!MoveFileExW(srcPath.c_str(), dstPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        throw std::runtime_error("Failed to replace '" + dstPath.u8string() + "'");
+#else
+    if (::rename(srcPath.c_str(), dstPath.c_str()) != 0)
+        throw std::runtime_error("Failed to replace '" + dstPath.u8string() + "'");
+
+    // Sync the directory so that the rename itself is durable
+    auto directory = dstPath.parent_path();
+    auto fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "FileSystem.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace cs
+{
+    /**
+     * Minimal wrapper around an OS file handle for file operations which need more control than
+     * std::fstream offers, such as syncing to disk and positional reads and writes. Used by
+     * FileStream for whole-file operations and by AsyncFileStream.
+     */
+    class NativeFile
+    {
+    private:
+#ifdef _WIN32
+        void* _handle{};
+#else
+        int _fd = -1;
+#endif
+
+    public:
+        /**
+         * Opens the file for reading, or for reading and writing if flags contains
+         * StreamFlags::write, in which case the file is created or truncated.
+         */
+        NativeFile(const fs::path& path, uint8_t flags);
+        NativeFile(const NativeFile&) = delete;
+        NativeFile& operator=(const NativeFile&) = delete;
+        ~NativeFile();
+
+#ifndef _WIN32
+        int getDescriptor() const
+        {
+            return _fd;
+        }
+#endif
+
+        uint64_t getSize() const;
+        void read(void* buffer, size_t len);
+        void write(const void* buffer, size_t len);
+        void readAt(uint64_t offset, void* buffer, size_t len);
+        void writeAt(uint64_t offset, const void* buffer, size_t len);
+        void sync();
+
+        /**
+         * Gives the file the mode and, where allowed, the owner of the file at the given path if it
+         * exists, so that the file can replace it without changing its permissions. Does nothing on
+         * Windows, where replace keeps the attributes and ACLs of the replaced file.
+         */
+        void copyPermissions(const fs::path& path);
+
+        /**
+         * Flushes a file that has already been written and closed by other means.
+         */
+        static void sync(const fs::path& path);
+
+        /**
+         * Resolves symbolic links in the given path so that the file they point to is replaced,
+         * rather than the link itself.
+         */
+        static fs::path resolveTarget(const fs::path& path);
+
+        /**
+         * Gets a unique path next to the given path to write a file to before it replaces the
+         * given path.
+         */
+        static fs::path getTemporaryPath(const fs::path& path);
+
+        /**
+         * Atomically replaces the target file with the given (already synced) file.
+         */
+        static void replace(const fs::path& srcPath, const fs::path& dstPath);
+    };
+}
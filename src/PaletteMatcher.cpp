@@ -0,0 +1,471 @@
+#include "PaletteMatcher.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define CS_PALETTE_MATCHER_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CS_TARGET(x)
+#else
+#define CS_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+using namespace cs;
+
+static constexpr int32_t cellSize = 256 / PaletteMatcher::cellsPerAxis;
+
+static uint32_t getKey(int32_t r, int32_t g, int32_t b)
+{
+    return (r << 16) | (g << 8) | b;
+}
+
+static bool isInRange(int32_t r, int32_t g, int32_t b)
+{
+    return (static_cast<uint32_t>(r) | static_cast<uint32_t>(g) | static_cast<uint32_t>(b)) <= 255;
+}
+
+static uint32_t getSquaredDistance(int32_t dr, int32_t dg, int32_t db)
+{
+    return static_cast<uint32_t>(dr * dr) + static_cast<uint32_t>(dg * dg) + static_cast<uint32_t>(db * db);
+}
+
+namespace
+{
+    struct Lab
+    {
+        float l;
+        float a;
+        float b;
+    };
+
+    // Converting 8-bit sRGB to linear light is the costly part, so it is only done once per value
+    const std::array<float, 256>& getLinearTable()
+    {
+        static const auto table = []() {
+            std::array<float, 256> result{};
+            for (size_t i = 0; i < result.size(); i++)
+            {
+                auto c = static_cast<float>(i) / 255.0f;
+                result[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    float labF(float t)
+    {
+        constexpr float delta = 6.0f / 29.0f;
+        return t > delta * delta * delta ? std::cbrt(t) : t / (3 * delta * delta) + 4.0f / 29.0f;
+    }
+
+    Lab toLab(ColourDistance distance, int32_t red, int32_t green, int32_t blue)
+    {
+        const auto& linear = getLinearTable();
+        auto r = linear[std::clamp(red, 0, 255)];
+        auto g = linear[std::clamp(green, 0, 255)];
+        auto b = linear[std::clamp(blue, 0, 255)];
+        if (distance == ColourDistance::cielab)
+        {
+            auto x = labF((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / 0.95047f);
+            auto y = labF(0.2126729f * r + 0.7151522f * g + 0.0721750f * b);
+            auto z = labF((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / 1.08883f);
+            return { 116 * y - 16, 500 * (x - y), 200 * (y - z) };
+        }
+
+        auto l = std::cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        auto m = std::cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        auto s = std::cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+        return {
+            0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+            1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+            0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s,
+        };
+    }
+}
+
+PaletteMatcher::PaletteMatcher(const Palette& palette, const std::bitset<PaletteSize>& candidates, ColourDistance distance)
+    : _palette(palette)
+    , _distance(distance)
+{
+    setKernel(PaletteSearchKernel::automatic);
+    std::fill(std::begin(_hashKeys), std::end(_hashKeys), emptyKey);
+    for (int32_t i = 0; i < PaletteSize; i++)
+    {
+        const auto& colour = palette.Colour[i];
+        auto key = getKey(colour.Red, colour.Green, colour.Blue);
+        auto slot = getHashSlot(key);
+        while (_hashKeys[slot] != emptyKey && _hashKeys[slot] != key)
+            slot = (slot + 1) % hashSize;
+
+        // Keep the lowest index for duplicate colours
+        if (_hashKeys[slot] == emptyKey)
+        {
+            _hashKeys[slot] = key;
+            _hashValues[slot] = static_cast<PaletteIndex>(i);
+        }
+
+        if (candidates[i])
+            _candidates.push_back(static_cast<PaletteIndex>(i));
+
+        _components.red[i] = colour.Red;
+        _components.green[i] = colour.Green;
+        _components.blue[i] = colour.Blue;
+        _components.mask[i] = candidates[i] ? 0 : 0xFFFFFFFF;
+
+        if (distance != ColourDistance::rgb)
+        {
+            auto lab = toLab(distance, colour.Red, colour.Green, colour.Blue);
+            _lab.l[i] = candidates[i] ? lab.l : std::numeric_limits<float>::infinity();
+            _lab.a[i] = lab.a;
+            _lab.b[i] = lab.b;
+        }
+    }
+
+    if (distance == ColourDistance::rgb)
+        buildCells();
+}
+
+uint32_t PaletteMatcher::getHashSlot(uint32_t key)
+{
+    return (key * 2654435761u) >> (32 - hashBits);
+}
+
+void PaletteMatcher::buildCells()
+{
+    constexpr auto numCells = cellsPerAxis * cellsPerAxis * cellsPerAxis;
+    _cellOffsets.resize(numCells + 1);
+
+    // The distance between a candidate and a cell is the sum of the distances along each axis,
+    // so compute those once for every cell coordinate
+    auto numCandidates = _candidates.size();
+    std::vector<uint32_t> axisDistances(3 * cellsPerAxis * numCandidates * 2);
+    auto getAxisDistances = [&](int32_t axis, uint32_t coord) { return axisDistances.data() + (axis * cellsPerAxis + coord) * numCandidates * 2; };
+    for (int32_t axis = 0; axis < 3; axis++)
+    {
+        for (uint32_t coord = 0; coord < cellsPerAxis; coord++)
+        {
+            auto lo = static_cast<int32_t>(coord) * cellSize;
+            auto hi = lo + cellSize - 1;
+            auto dst = getAxisDistances(axis, coord);
+            for (size_t i = 0; i < numCandidates; i++)
+            {
+                const auto& colour = _palette.Colour[_candidates[i]];
+                int32_t p = axis == 0 ? colour.Red : (axis == 1 ? colour.Green : colour.Blue);
+                auto minD = p < lo ? lo - p : (p > hi ? p - hi : 0);
+                auto maxD = std::max(std::abs(p - lo), std::abs(p - hi));
+                dst[i * 2] = minD * minD;
+                dst[i * 2 + 1] = maxD * maxD;
+            }
+        }
+    }
+
+    std::vector<uint32_t> minDistances(numCandidates);
+    for (uint32_t cell = 0; cell < numCells; cell++)
+    {
+        _cellOffsets[cell] = static_cast<uint32_t>(_cellCandidates.size());
+
+        auto r = getAxisDistances(0, cell >> (cellBits * 2));
+        auto g = getAxisDistances(1, (cell >> cellBits) % cellsPerAxis);
+        auto b = getAxisDistances(2, cell % cellsPerAxis);
+
+        // A candidate can only be nearest to a colour in the cell if its distance to the cell
+        // is no more than the smallest distance that is guaranteed to reach the whole cell
+        auto bestMaxDistance = std::numeric_limits<uint32_t>::max();
+        for (size_t i = 0; i < numCandidates; i++)
+        {
+            minDistances[i] = r[i * 2] + g[i * 2] + b[i * 2];
+            bestMaxDistance = std::min(bestMaxDistance, r[i * 2 + 1] + g[i * 2 + 1] + b[i * 2 + 1]);
+        }
+        for (size_t i = 0; i < numCandidates; i++)
+        {
+            if (minDistances[i] <= bestMaxDistance)
+                _cellCandidates.push_back(_candidates[i]);
+        }
+    }
+    _cellOffsets[numCells] = static_cast<uint32_t>(_cellCandidates.size());
+}
+
+namespace
+{
+    PaletteIndex findClosestScalar(const PaletteMatcher::ComponentArrays& palette, int32_t r, int32_t g, int32_t b)
+    {
+        auto smallestError = std::numeric_limits<uint32_t>::max();
+        PaletteIndex bestMatch = 0;
+        for (int32_t i = 0; i < PaletteSize; i++)
+        {
+            auto error = getSquaredDistance(palette.red[i] - r, palette.green[i] - g, palette.blue[i] - b) | palette.mask[i];
+            if (error < smallestError)
+            {
+                bestMatch = static_cast<PaletteIndex>(i);
+                smallestError = error;
+            }
+        }
+        return bestMatch;
+    }
+
+#ifdef CS_PALETTE_MATCHER_X86
+    // The closest of the lanes, the lowest index if several are equally close
+    PaletteIndex reduceLanes(const uint32_t* errors, const uint32_t* indices, int32_t numLanes)
+    {
+        auto smallestError = errors[0];
+        auto bestMatch = indices[0];
+        for (int32_t i = 1; i < numLanes; i++)
+        {
+            if (errors[i] < smallestError || (errors[i] == smallestError && indices[i] < bestMatch))
+            {
+                smallestError = errors[i];
+                bestMatch = indices[i];
+            }
+        }
+        return static_cast<PaletteIndex>(bestMatch);
+    }
+
+    /**
+     * Each lane keeps the closest entry it has seen, only replacing it with one strictly closer so
+     * that lanes keep their lowest index. Errors are unsigned, so they are compared with the sign
+     * bit flipped.
+     */
+    CS_TARGET("sse4.1")
+    PaletteIndex findClosestSse41(const PaletteMatcher::ComponentArrays& palette, int32_t r, int32_t g, int32_t b)
+    {
+        auto signBit = _mm_set1_epi32(static_cast<int32_t>(0x80000000));
+        auto vr = _mm_set1_epi32(r);
+        auto vg = _mm_set1_epi32(g);
+        auto vb = _mm_set1_epi32(b);
+        auto lane = _mm_setr_epi32(0, 1, 2, 3);
+        auto step = _mm_set1_epi32(4);
+        auto smallestError = _mm_set1_epi32(-1);
+        auto bestMatch = _mm_setzero_si128();
+        for (int32_t i = 0; i < PaletteSize; i += 4)
+        {
+            auto dr = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(palette.red + i)), vr);
+            auto dg = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(palette.green + i)), vg);
+            auto db = _mm_sub_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(palette.blue + i)), vb);
+            auto error = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(dr, dr), _mm_mullo_epi32(dg, dg)), _mm_mullo_epi32(db, db));
+            error = _mm_or_si128(error, _mm_load_si128(reinterpret_cast<const __m128i*>(palette.mask + i)));
+
+            auto closer = _mm_cmplt_epi32(_mm_xor_si128(error, signBit), _mm_xor_si128(smallestError, signBit));
+            smallestError = _mm_blendv_epi8(smallestError, error, closer);
+            bestMatch = _mm_blendv_epi8(bestMatch, lane, closer);
+            lane = _mm_add_epi32(lane, step);
+        }
+
+        alignas(16) uint32_t errors[4];
+        alignas(16) uint32_t indices[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(errors), smallestError);
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices), bestMatch);
+        return reduceLanes(errors, indices, 4);
+    }
+
+    CS_TARGET("avx2")
+    inline void updateClosest(const PaletteMatcher::ComponentArrays& palette, int32_t i, __m256i r, __m256i g, __m256i b, __m256i& smallestError, __m256i& bestMatch)
+    {
+        auto signBit = _mm256_set1_epi32(static_cast<int32_t>(0x80000000));
+        auto dr = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(palette.red + i)), r);
+        auto dg = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(palette.green + i)), g);
+        auto db = _mm256_sub_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(palette.blue + i)), b);
+        auto error = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+        error = _mm256_or_si256(error, _mm256_load_si256(reinterpret_cast<const __m256i*>(palette.mask + i)));
+
+        auto closer = _mm256_cmpgt_epi32(_mm256_xor_si256(smallestError, signBit), _mm256_xor_si256(error, signBit));
+        auto lane = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        smallestError = _mm256_blendv_epi8(smallestError, error, closer);
+        bestMatch = _mm256_blendv_epi8(bestMatch, lane, closer);
+    }
+
+    // Compares 16 entries per iteration, in two independent sets of lanes
+    CS_TARGET("avx2")
+    PaletteIndex findClosestAvx2(const PaletteMatcher::ComponentArrays& palette, int32_t r, int32_t g, int32_t b)
+    {
+        auto vr = _mm256_set1_epi32(r);
+        auto vg = _mm256_set1_epi32(g);
+        auto vb = _mm256_set1_epi32(b);
+        __m256i smallestError[2] = { _mm256_set1_epi32(-1), _mm256_set1_epi32(-1) };
+        __m256i bestMatch[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+        for (int32_t i = 0; i < PaletteSize; i += 16)
+        {
+            updateClosest(palette, i, vr, vg, vb, smallestError[0], bestMatch[0]);
+            updateClosest(palette, i + 8, vr, vg, vb, smallestError[1], bestMatch[1]);
+        }
+
+        alignas(32) uint32_t errors[16];
+        alignas(32) uint32_t indices[16];
+        for (int32_t i = 0; i < 2; i++)
+        {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(errors + i * 8), smallestError[i]);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(indices + i * 8), bestMatch[i]);
+        }
+        return reduceLanes(errors, indices, 16);
+    }
+
+#ifdef _MSC_VER
+    bool isSse41Supported()
+    {
+        int32_t info[4];
+        __cpuid(info, 1);
+        return (info[2] >> 19) & 1;
+    }
+
+    bool isAvx2Supported()
+    {
+        int32_t info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        // The OS must also save the AVX registers on context switches
+        __cpuid(info, 1);
+        auto osxsave = (info[2] >> 27) & 1;
+        auto avx = (info[2] >> 28) & 1;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] >> 5) & 1;
+    }
+#else
+    bool isSse41Supported()
+    {
+        return __builtin_cpu_supports("sse4.1");
+    }
+
+    bool isAvx2Supported()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+#endif
+
+    PaletteSearchKernel getBestKernel()
+    {
+#ifdef CS_PALETTE_MATCHER_X86
+        if (isAvx2Supported())
+            return PaletteSearchKernel::avx2;
+        if (isSse41Supported())
+            return PaletteSearchKernel::sse41;
+#endif
+        return PaletteSearchKernel::scalar;
+    }
+}
+
+bool PaletteMatcher::isKernelSupported(PaletteSearchKernel kernel)
+{
+    switch (kernel)
+    {
+        case PaletteSearchKernel::automatic:
+        case PaletteSearchKernel::scalar:
+            return true;
+#ifdef CS_PALETTE_MATCHER_X86
+        case PaletteSearchKernel::sse41:
+            return isSse41Supported();
+        case PaletteSearchKernel::avx2:
+            return isAvx2Supported();
+#endif
+        default:
+            return false;
+    }
+}
+
+void PaletteMatcher::setKernel(PaletteSearchKernel kernel)
+{
+    if (!isKernelSupported(kernel))
+        throw std::runtime_error("Palette search kernel is not supported");
+
+    if (kernel == PaletteSearchKernel::automatic)
+    {
+        static const auto bestKernel = getBestKernel();
+        kernel = bestKernel;
+    }
+    switch (kernel)
+    {
+#ifdef CS_PALETTE_MATCHER_X86
+        case PaletteSearchKernel::sse41:
+            _searchFunc = findClosestSse41;
+            break;
+        case PaletteSearchKernel::avx2:
+            _searchFunc = findClosestAvx2;
+            break;
+#endif
+        default:
+            _searchFunc = findClosestScalar;
+            break;
+    }
+}
+
+std::optional<PaletteIndex> PaletteMatcher::findExact(int32_t r, int32_t g, int32_t b) const
+{
+    if (!isInRange(r, g, b))
+        return std::nullopt;
+
+    auto key = getKey(r, g, b);
+    auto slot = getHashSlot(key);
+    while (_hashKeys[slot] != emptyKey)
+    {
+        if (_hashKeys[slot] == key)
+            return _hashValues[slot];
+        slot = (slot + 1) % hashSize;
+    }
+    return std::nullopt;
+}
+
+PaletteIndex PaletteMatcher::findClosest(int32_t r, int32_t g, int32_t b) const
+{
+    if (_distance != ColourDistance::rgb)
+        return findClosestLab(r, g, b);
+
+    if (!isInRange(r, g, b))
+    {
+        // Cells only cover the RGB cube, dithering can push colours outside of it
+        return _searchFunc(_components, r, g, b);
+    }
+
+    auto cell = ((r / cellSize) << (cellBits * 2)) | ((g / cellSize) << cellBits) | (b / cellSize);
+    auto begin = _cellCandidates.data() + _cellOffsets[cell];
+    auto end = _cellCandidates.data() + _cellOffsets[cell + 1];
+    return findClosest(begin, end, r, g, b);
+}
+
+PaletteIndex PaletteMatcher::findClosest(const PaletteIndex* begin, const PaletteIndex* end, int32_t r, int32_t g, int32_t b) const
+{
+    auto smallestError = std::numeric_limits<uint32_t>::max();
+    PaletteIndex bestMatch = 0;
+    for (auto it = begin; it != end; it++)
+    {
+        const auto& colour = _palette.Colour[*it];
+        auto error = getSquaredDistance(colour.Red - r, colour.Green - g, colour.Blue - b);
+        if (error < smallestError)
+        {
+            bestMatch = *it;
+            smallestError = error;
+        }
+    }
+    return bestMatch;
+}
+
+PaletteIndex PaletteMatcher::findClosestLab(int32_t r, int32_t g, int32_t b) const
+{
+    auto colour = toLab(_distance, r, g, b);
+    auto smallestError = std::numeric_limits<float>::infinity();
+    PaletteIndex bestMatch = 0;
+    for (int32_t i = 0; i < PaletteSize; i++)
+    {
+        auto dl = _lab.l[i] - colour.l;
+        auto da = _lab.a[i] - colour.a;
+        auto db = _lab.b[i] - colour.b;
+        auto error = dl * dl + da * da + db * db;
+        if (error < smallestError)
+        {
+            bestMatch = static_cast<PaletteIndex>(i);
+            smallestError = error;
+        }
+    }
+    return bestMatch;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Palette.h"
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace cs
+{
+    enum class ColourDistance : uint8_t
+    {
+        // Squared distance between sRGB values
+        rgb,
+
+        // Squared distance in CIELAB with a D65 white point (CIE76)
+        cielab,
+
+        // Squared distance in OKLab
+        oklab,
+    };
+
+    // Implementations of the search over every entry of the palette
+    enum class PaletteSearchKernel : uint8_t
+    {
+        // The fastest kernel the CPU supports
+        automatic,
+        scalar,
+        sse41,
+        avx2,
+    };
+
+    /**
+     * Finds palette entries for colours without scanning the whole palette. Exact matches are
+     * found with a hash table. For nearest matches, the RGB cube is divided into cells, each of
+     * which lists the only candidates that can be nearest to a colour inside it. Perceptual
+     * distances compare against Lab coordinates of the palette computed up front instead.
+     */
+    class PaletteMatcher
+    {
+    public:
+        static constexpr uint32_t cellBits = 5;
+        static constexpr uint32_t cellsPerAxis = 1 << cellBits;
+
+        /**
+         * The palette as separate arrays of components, so that many entries can be compared at
+         * once. Entries which are not candidates have a mask of all ones so they are never closest.
+         */
+        struct ComponentArrays
+        {
+            alignas(32) int32_t red[PaletteSize];
+            alignas(32) int32_t green[PaletteSize];
+            alignas(32) int32_t blue[PaletteSize];
+            alignas(32) uint32_t mask[PaletteSize];
+        };
+
+        // Lab coordinates of the palette, entries which are not candidates are infinitely far away
+        struct LabArrays
+        {
+            alignas(32) float l[PaletteSize];
+            alignas(32) float a[PaletteSize];
+            alignas(32) float b[PaletteSize];
+        };
+
+    private:
+        static constexpr uint32_t hashBits = 9;
+        static constexpr uint32_t hashSize = 1 << hashBits;
+        static constexpr uint32_t emptyKey = 0xFFFFFFFF;
+
+        using SearchFunc = PaletteIndex (*)(const ComponentArrays& palette, int32_t r, int32_t g, int32_t b);
+
+        Palette _palette;
+        uint32_t _hashKeys[hashSize];
+        PaletteIndex _hashValues[hashSize]{};
+        std::vector<PaletteIndex> _candidates;
+        std::vector<uint32_t> _cellOffsets;
+        std::vector<PaletteIndex> _cellCandidates;
+        ComponentArrays _components;
+        ColourDistance _distance{};
+        LabArrays _lab;
+        SearchFunc _searchFunc{};
+
+        static uint32_t getHashSlot(uint32_t key);
+        void buildCells();
+        PaletteIndex findClosest(const PaletteIndex* begin, const PaletteIndex* end, int32_t r, int32_t g, int32_t b) const;
+        PaletteIndex findClosestLab(int32_t r, int32_t g, int32_t b) const;
+
+    public:
+        /**
+         * @param candidates the entries that can be returned by findClosest.
+         * @param distance how findClosest measures the distance between colours.
+         */
+        PaletteMatcher(const Palette& palette, const std::bitset<PaletteSize>& candidates, ColourDistance distance = ColourDistance::rgb);
+
+        const Palette& getPalette() const
+        {
+            return _palette;
+        }
+
+        ColourDistance getDistance() const
+        {
+            return _distance;
+        }
+
+        static bool isKernelSupported(PaletteSearchKernel kernel);
+
+        /**
+         * Chooses the kernel used for colours outside the RGB cube, which can not use the cells.
+         * Only needed to compare kernels, throws if the CPU does not support the kernel.
+         */
+        void setKernel(PaletteSearchKernel kernel);
+
+        /**
+         * @returns the lowest index with exactly the given colour, if there is one.
+         */
+        std::optional<PaletteIndex> findExact(int32_t r, int32_t g, int32_t b) const;
+
+        /**
+         * @returns the candidate with the smallest distance to the colour, the lowest index if
+         *          several are equally close. Components outside 0-255 are allowed, for perceptual
+         *          distances they are clamped.
+         */
+        PaletteIndex findClosest(int32_t r, int32_t g, int32_t b) const;
+    };
+}
@@ -6,14 +6,6 @@
 #include <memory>
 #include <stdexcept>
 
-#ifdef _WIN32
-#ifndef NOMINMAX
-#define NOMINMAX
-#endif
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
-#endif
-
 using namespace cs;
 
 constexpr const char* exceptionReadError = "Failed to read data from stream";
@@ -21,110 +13,6 @@ constexpr const char* exceptionWriteError = "Failed to write data to stream";
 constexpr const char* exceptionInvalidRLE = "Invalid RLE run";
 constexpr const char* exceptionUnknownEncoding = "Unknown encoding";
 
-uint8_t* FastBuffer::alloc(size_t len)
-{
-#ifdef _WIN32
-    return reinterpret_cast<uint8_t*>(HeapAlloc(GetProcessHeap(), 0, len));
-#else
-    return reinterpret_cast<uint8_t*>(std::malloc(len));
-#endif
-}
-
-uint8_t* FastBuffer::realloc(uint8_t* ptr, size_t len)
-{
-#ifdef _WIN32
-    return reinterpret_cast<uint8_t*>(HeapReAlloc(GetProcessHeap(), 0, ptr, len));
-#else
-    return reinterpret_cast<uint8_t*>(std::realloc(ptr, len));
-#endif
-}
-
-void FastBuffer::free(uint8_t* ptr)
-{
-#ifdef _WIN32
-    HeapFree(GetProcessHeap(), 0, ptr);
-#else
-    std::free(ptr);
-#endif
-}
-
-FastBuffer::~FastBuffer()
-{
-    if (_data != nullptr)
-    {
-        free(_data);
-        _data = 0;
-        _len = 0;
-        _capacity = 0;
-    }
-}
-
-uint8_t* FastBuffer::data()
-{
-    return _data;
-}
-
-size_t FastBuffer::size() const
-{
-    return _len;
-}
-
-void FastBuffer::resize(size_t len)
-{
-    reserve(len);
-    _len = len;
-}
-
-void FastBuffer::reserve(size_t len)
-{
-    if (_capacity < len)
-    {
-        do
-        {
-            _capacity = std::max<size_t>(256, _capacity * 2);
-        } while (_capacity < len);
-        auto newData = _data == nullptr ? alloc(_capacity) : realloc(_data, _capacity);
-        if (newData == nullptr)
-        {
-            throw std::bad_alloc();
-        }
-        else
-        {
-            _data = reinterpret_cast<uint8_t*>(newData);
-        }
-    }
-}
-
-void FastBuffer::clear()
-{
-    _len = 0;
-}
-
-void FastBuffer::push_back(uint8_t value)
-{
-    reserve(_len + 1);
-    _data[_len++] = value;
-}
-
-void FastBuffer::push_back(uint8_t value, size_t len)
-{
-    reserve(_len + len);
-    std::memset(&_data[_len], value, len);
-    _len += len;
-}
-
-void FastBuffer::push_back(const uint8_t* src, size_t len)
-{
-    reserve(_len + len);
-    std::memcpy(&_data[_len], src, len);
-    _len += len;
-}
-
-stdx::span<uint8_t const> FastBuffer::getSpan() const
-{
-    return stdx::span<uint8_t const>(_data, _len);
-}
-
 SawyerStreamReader::SawyerStreamReader(Stream& stream)
 {
     _stream = &stream;
@@ -136,8 +24,21 @@ SawyerStreamReader::SawyerStreamReader(const fs::path& path)
     _stream = _fstream.get();
 }
 
+void SawyerStreamReader::endChunkStream()
+{
+    _chunkStream = {};
+    if (_readPosition)
+    {
+        // The chunk stream may have moved the underlying stream anywhere within the chunk
+        _stream->setPosition(*_readPosition);
+        _readPosition = std::nullopt;
+    }
+}
+
 stdx::span<uint8_t const> SawyerStreamReader::readChunk()
 {
+    endChunkStream();
+
     SawyerEncoding encoding;
     read(&encoding, sizeof(encoding));
 
@@ -157,11 +58,49 @@ size_t SawyerStreamReader::readChunk(void* data, size_t maxDataLen)
     return chunkData.size();
 }
 
+Stream& SawyerStreamReader::readChunkStream()
+{
+    endChunkStream();
+
+    SawyerEncoding encoding;
+    read(&encoding, sizeof(encoding));
+
+    uint32_t length;
+    read(&length, sizeof(length));
+
+    if (encoding == SawyerEncoding::uncompressed)
+    {
+        auto offset = _stream->getPosition();
+        if (length > _stream->getLength() - offset)
+            throw std::runtime_error(exceptionReadError);
+        _chunkStream = std::make_unique<SubStream>(*_stream, offset, length);
+        _readPosition = offset + length;
+        _stream->setPosition(*_readPosition);
+    }
+    else
+    {
+        _decodeBuffer.resize(length);
+        read(_decodeBuffer.data(), length);
+        _chunkStream = std::make_unique<BinaryStream>(decode(encoding, _decodeBuffer.getSpan()));
+    }
+    return *_chunkStream;
+}
+
 void SawyerStreamReader::read(void* data, size_t dataLen)
 {
     try
     {
-        _stream->read(data, dataLen);
+        // Reads on an open chunk stream move the underlying stream, so continue from after the chunk
+        if (_readPosition)
+        {
+            _stream->setPosition(*_readPosition);
+            _stream->read(data, dataLen);
+            _readPosition = _stream->getPosition();
+        }
+        else
+        {
+            _stream->read(data, dataLen);
+        }
     }
     catch (...)
     {
@@ -178,7 +117,7 @@ bool SawyerStreamReader::validateChecksum()
     {
         // Read checksum
         uint32_t checksum;
-        _stream->seek(fileLength - 4);
+        _stream->setPosition(fileLength - 4);
         _stream->read(&checksum, sizeof(checksum));
 
         // Calculate checksum
@@ -206,6 +145,8 @@ bool SawyerStreamReader::validateChecksum()
 
 void SawyerStreamReader::close()
 {
+    _chunkStream = {};
+    _readPosition = std::nullopt;
     _fstream = {};
     _stream = nullptr;
 }
@@ -322,21 +263,38 @@ SawyerStreamWriter::SawyerStreamWriter(Stream& stream)
 
 SawyerStreamWriter::SawyerStreamWriter(const fs::path& path)
 {
-    _fstream = std::make_unique<FileStream>(path, StreamFlags::write);
+    // Write via a temporary file so an existing file is never left half written
+    _fstream = std::make_unique<FileStream>(path, StreamFlags::write | StreamFlags::atomic);
     _stream = _fstream.get();
 }
 
 void SawyerStreamWriter::writeChunk(SawyerEncoding chunkType, const void* data, size_t dataLen)
 {
     auto encodedData = encode(chunkType, stdx::span(reinterpret_cast<const uint8_t*>(data), dataLen));
-    write(&chunkType, sizeof(chunkType));
-    write(static_cast<uint32_t>(encodedData.size()));
-    write(encodedData.data(), encodedData.size());
+
+    // Gather the chunk header and payload into a single write
+    uint8_t header[5];
+    auto encodedLength = static_cast<uint32_t>(encodedData.size());
+    header[0] = static_cast<uint8_t>(chunkType);
+    std::memcpy(&header[1], &encodedLength, sizeof(encodedLength));
+
+    StreamBuffer buffers[] = {
+        { header, sizeof(header) },
+        { encodedData.data(), encodedData.size() },
+    };
+    writeStream(buffers);
+    updateChecksum(header, sizeof(header));
+    updateChecksum(encodedData.data(), encodedData.size());
 }
 
 void SawyerStreamWriter::write(const void* data, size_t dataLen)
 {
     writeStream(data, dataLen);
+    updateChecksum(data, dataLen);
+}
+
+void SawyerStreamWriter::updateChecksum(const void* data, size_t dataLen)
+{
     auto data8 = reinterpret_cast<const uint8_t*>(data);
     for (size_t i = 0; i < dataLen; i++)
     {
@@ -361,8 +319,36 @@ void SawyerStreamWriter::writeStream(const void* data, size_t dataLen)
     }
 }
 
+void SawyerStreamWriter::writeStream(stdx::span<const StreamBuffer> buffers)
+{
+    try
+    {
+        _stream->writev(buffers);
+    }
+    catch (...)
+    {
+        throw std::runtime_error(exceptionWriteError);
+    }
+}
+
 void SawyerStreamWriter::close()
 {
+    if (_stream != nullptr)
+    {
+        // Make sure any buffered or in-flight writes have completed
+        try
+        {
+            _stream->flush();
+            if (_fstream != nullptr)
+            {
+                _fstream->commit();
+            }
+        }
+        catch (...)
+        {
+            throw std::runtime_error(exceptionWriteError);
+        }
+    }
     _fstream = {};
     _stream = nullptr;
 }
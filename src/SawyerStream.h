@@ -1,10 +1,13 @@
 #pragma once
 
+#include "FastBuffer.h"
 #include "FileSystem.hpp"
 #include "Span.hpp"
 #include "Stream.h"
 #include <cstdint>
 #include <fstream>
+#include <memory>
+#include <optional>
 
 namespace cs
 {
@@ -16,39 +19,6 @@ namespace cs
         rotate,
     };
 
-    /**
-     * Provides a more efficient implementation than std::vector for allocating and
-     * pushing bytes to a buffer.
-     *
-     * In particular, for Windows, HeapAlloc is used for a direct memory block from the OS
-     * which is not initialised (even in debug builds). It vastly reduces the time needed
-     * to load / save S5 files in debug builds.
-     */
-    class FastBuffer
-    {
-    private:
-        uint8_t* _data{};
-        size_t _len{};
-        size_t _capacity{};
-
-        static uint8_t* alloc(size_t len);
-        static uint8_t* realloc(uint8_t* ptr, size_t len);
-        static void free(uint8_t* ptr);
-
-    public:
-        ~FastBuffer();
-
-        uint8_t* data();
-        size_t size() const;
-        void resize(size_t len);
-        void reserve(size_t len);
-        void clear();
-        void push_back(uint8_t value);
-        void push_back(uint8_t value, size_t len);
-        void push_back(const uint8_t* src, size_t len);
-        stdx::span<uint8_t const> getSpan() const;
-    };
-
     class SawyerStreamReader
     {
     private:
@@ -56,7 +26,11 @@ namespace cs
         std::unique_ptr<FileStream> _fstream;
         FastBuffer _decodeBuffer;
         FastBuffer _decodeBuffer2;
+        std::unique_ptr<Stream> _chunkStream;
+        // Where the reader continues from while an uncompressed chunk stream may move the stream
+        std::optional<uint64_t> _readPosition;
 
+        void endChunkStream();
         stdx::span<uint8_t const> decode(SawyerEncoding encoding, stdx::span<uint8_t const> data);
         static void decodeRunLengthSingle(FastBuffer& buffer, stdx::span<uint8_t const> data);
         static void decodeRunLengthMulti(FastBuffer& buffer, stdx::span<uint8_t const> data);
@@ -68,6 +42,13 @@ namespace cs
 
         stdx::span<uint8_t const> readChunk();
         size_t readChunk(void* data, size_t maxDataLen);
+
+        /**
+         * Returns a stream over the data of the next chunk. Uncompressed chunks are read lazily
+         * from the underlying stream, other encodings are decoded first. The returned stream is
+         * valid until the next chunk is read.
+         */
+        Stream& readChunkStream();
         void read(void* data, size_t dataLen);
         bool validateChecksum();
         void close();
@@ -83,6 +64,8 @@ namespace cs
         FastBuffer _encodeBuffer2;
 
         void writeStream(const void* data, size_t dataLen);
+        void writeStream(stdx::span<const StreamBuffer> buffers);
+        void updateChecksum(const void* data, size_t dataLen);
         stdx::span<uint8_t const> encode(SawyerEncoding encoding, stdx::span<uint8_t const> data);
         static void encodeRunLengthSingle(FastBuffer& buffer, stdx::span<uint8_t const> data);
         static void encodeRunLengthMulti(FastBuffer& buffer, stdx::span<uint8_t const> data);
@@ -0,0 +1,121 @@
+#include "SpriteCache.h"
+#include <algorithm>
+
+using namespace cs;
+
+SpriteCache::SpriteCache(GetEntryFunc getEntry, uint32_t numEntries, size_t budget)
+    : _getEntry(std::move(getEntry))
+    , _numEntries(numEntries)
+    , _budget(budget)
+{
+}
+
+uint64_t SpriteCache::getKey(uint32_t index, uint8_t zoom)
+{
+    return (static_cast<uint64_t>(index) << 8) | zoom;
+}
+
+std::shared_ptr<const SpriteCache::Sprite> SpriteCache::get(uint32_t index, uint8_t zoom)
+{
+    auto key = getKey(index, zoom);
+    auto it = _items.find(key);
+    if (it != _items.end())
+    {
+        // Move to the front of the LRU list
+        _lru.splice(_lru.begin(), _lru, it->second.lruPosition);
+        return it->second.sprite;
+    }
+
+    auto sprite = decode(index, zoom);
+    insert(key, sprite);
+    evict();
+    return sprite;
+}
+
+void SpriteCache::prefetch(uint32_t index, uint32_t count, uint8_t zoom)
+{
+    auto end = std::min<uint64_t>(static_cast<uint64_t>(index) + count, _numEntries);
+    for (auto i = static_cast<uint64_t>(index); i < end; i++)
+    {
+        auto key = getKey(static_cast<uint32_t>(i), zoom);
+        if (_items.find(key) != _items.end())
+            continue;
+
+        auto entry = _getEntry(static_cast<uint32_t>(i));
+        if (entry.flags & GxFlags::isPalette)
+            continue;
+
+        auto sprite = decode(static_cast<uint32_t>(i), zoom);
+        if (_usage + sprite->pixels.size() > _budget)
+            break;
+        insert(key, sprite);
+    }
+}
+
+bool SpriteCache::contains(uint32_t index, uint8_t zoom) const
+{
+    return _items.find(getKey(index, zoom)) != _items.end();
+}
+
+size_t SpriteCache::getUsage() const
+{
+    return _usage;
+}
+
+void SpriteCache::clear()
+{
+    _items.clear();
+    _lru.clear();
+    _usage = 0;
+}
+
+std::shared_ptr<const SpriteCache::Sprite> SpriteCache::decode(uint32_t index, uint8_t zoom) const
+{
+    // Use the separate zoomed entry when there is one, it is already half the size
+    auto gx = _getEntry(index);
+    while (zoom > 0 && (gx.flags & GxFlags::hasZoom) && gx.zoomOffset != 0 && gx.zoomOffset <= index)
+    {
+        index -= gx.zoomOffset;
+        gx = _getEntry(index);
+        zoom--;
+    }
+
+    auto scale = 1 << zoom;
+    auto sprite = std::make_shared<Sprite>();
+    sprite->width = (gx.width + scale - 1) >> zoom;
+    sprite->height = (gx.height + scale - 1) >> zoom;
+    sprite->offsetX = gx.offsetX >> zoom;
+    sprite->offsetY = gx.offsetY >> zoom;
+    sprite->pixels.resize(static_cast<size_t>(sprite->width) * sprite->height);
+
+    GxSurface surface;
+    surface.bits = sprite->pixels.data();
+    surface.width = sprite->width;
+    surface.height = sprite->height;
+    surface.stride = sprite->width;
+
+    GxDrawOptions options;
+    options.zoom = zoom;
+    gx.draw(surface, -gx.offsetX, -gx.offsetY, options);
+    return sprite;
+}
+
+void SpriteCache::insert(uint64_t key, std::shared_ptr<const Sprite> sprite)
+{
+    _usage += sprite->pixels.size();
+    _lru.push_front(key);
+    _items[key] = Item{ std::move(sprite), _lru.begin() };
+}
+
+void SpriteCache::evict()
+{
+    // Always keep the most recently used sprite, even if it is larger than the budget
+    while (_usage > _budget && _lru.size() > 1)
+    {
+        auto key = _lru.back();
+        _lru.pop_back();
+        auto it = _items.find(key);
+        _usage -= it->second.sprite->pixels.size();
+        _items.erase(it);
+    }
+}
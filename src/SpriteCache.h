@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Gx.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace cs
+{
+    /**
+     * Holds decoded 8-bit bitmaps of a set of entries, such as an archive, keyed by entry index and
+     * zoom level, so that entries used repeatedly are only decoded once. The least recently used
+     * bitmaps are evicted when the total size of the bitmaps exceeds the memory budget. A cache
+     * must only be used by one thread at a time.
+     */
+    class SpriteCache
+    {
+    public:
+        static constexpr size_t defaultBudget = 64 * 1024 * 1024;
+
+        using GetEntryFunc = std::function<GxEntry(uint32_t index)>;
+
+        struct Sprite
+        {
+            int32_t width{};
+            int32_t height{};
+            int32_t offsetX{};
+            int32_t offsetY{};
+            std::vector<uint8_t> pixels;
+        };
+
+    private:
+        struct Item
+        {
+            std::shared_ptr<const Sprite> sprite;
+            std::list<uint64_t>::iterator lruPosition;
+        };
+
+        GetEntryFunc _getEntry;
+        uint32_t _numEntries{};
+        size_t _budget{};
+        size_t _usage{};
+        std::unordered_map<uint64_t, Item> _items;
+        std::list<uint64_t> _lru;
+
+        static uint64_t getKey(uint32_t index, uint8_t zoom);
+        std::shared_ptr<const Sprite> decode(uint32_t index, uint8_t zoom) const;
+        void insert(uint64_t key, std::shared_ptr<const Sprite> sprite);
+        void evict();
+
+    public:
+        /**
+         * @param getEntry returns the entry for an index below numEntries.
+         */
+        SpriteCache(GetEntryFunc getEntry, uint32_t numEntries, size_t budget = defaultBudget);
+
+        /**
+         * Gets the bitmap of an entry at the given zoom level, decoding it if it is not cached.
+         * Entries with GxFlags::hasZoom use their separate zoomed entry. The returned bitmap stays
+         * valid while it is held, even if it is evicted from the cache.
+         */
+        std::shared_ptr<const Sprite> get(uint32_t index, uint8_t zoom = 0);
+
+        /**
+         * Hints that the entries [index, index + count) will be needed soon. Entries are decoded
+         * in advance while they fit within the budget without evicting anything.
+         */
+        void prefetch(uint32_t index, uint32_t count, uint8_t zoom = 0);
+
+        bool contains(uint32_t index, uint8_t zoom = 0) const;
+        size_t getUsage() const;
+        void clear();
+    };
+}
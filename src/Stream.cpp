@@ -1,14 +1,29 @@
 #include "Stream.h"
+#include "NativeFile.h"
+#include <algorithm>
 #include <cstring>
+#include <exception>
 #include <stdexcept>
+#include <string>
 
 using namespace cs;
 
+constexpr const char* exceptionReadError = "Failed to read data";
+constexpr const char* exceptionWriteError = "Failed to write data";
+
 void Stream::seek(int64_t pos)
 {
     setPosition(getPosition() + pos);
 }
 
+void Stream::writev(stdx::span<const StreamBuffer> buffers)
+{
+    for (const auto& buffer : buffers)
+    {
+        write(buffer.data, buffer.len);
+    }
+}
+
 void Stream::throwInvalidOperation() { throw std::runtime_error("Invalid operation"); }
 
 BinaryStream::BinaryStream(const void* data, size_t len)
@@ -38,11 +53,76 @@ void BinaryStream::read(void* buffer, size_t len)
 {
     auto maxReadLen = _len - _index;
     if (len > maxReadLen)
-        throw std::runtime_error("Failed to read data");
+        throw std::runtime_error(exceptionReadError);
     std::memcpy(buffer, reinterpret_cast<const void*>(reinterpret_cast<size_t>(_data) + _index), len);
     _index += len;
 }
 
+SubStream::SubStream(Stream& stream, uint64_t offset, uint64_t len)
+    : _stream(&stream)
+    , _offset(offset)
+    , _len(len)
+{
+    if (offset > stream.getLength() || len > stream.getLength() - offset)
+        throw std::out_of_range("Sub stream exceeds parent stream");
+}
+
+uint64_t SubStream::getLength() const
+{
+    return _len;
+}
+
+uint64_t SubStream::getPosition() const
+{
+    return _index;
+}
+
+void SubStream::setPosition(uint64_t position)
+{
+    if (position > _len)
+        throw std::out_of_range("Position too large");
+    _index = position;
+}
+
+void SubStream::seekParent()
+{
+    // Avoid seeking when reading sequentially, file streams discard their buffer on seek
+    auto position = _offset + _index;
+    if (_stream->getPosition() != position)
+    {
+        _stream->setPosition(position);
+    }
+}
+
+void SubStream::read(void* buffer, size_t len)
+{
+    if (len > _len - _index)
+        throw std::runtime_error(exceptionReadError);
+    if (len != 0)
+    {
+        seekParent();
+        _stream->read(buffer, len);
+        _index += len;
+    }
+}
+
+void SubStream::write(const void* buffer, size_t len)
+{
+    if (len > _len - _index)
+        throw std::runtime_error(exceptionWriteError);
+    if (len != 0)
+    {
+        seekParent();
+        _stream->write(buffer, len);
+        _index += len;
+    }
+}
+
+void SubStream::flush()
+{
+    _stream->flush();
+}
+
 void MemoryStream::ensureLength(size_t len)
 {
     if (_data.size() < len)
@@ -80,7 +160,7 @@ void MemoryStream::read(void* buffer, size_t len)
 {
     auto maxReadLen = _data.size() - _index;
     if (len > maxReadLen)
-        throw std::runtime_error("Failed to read data");
+        throw std::runtime_error(exceptionReadError);
     std::memcpy(buffer, reinterpret_cast<const void*>(reinterpret_cast<size_t>(_data.data()) + _index), len);
     _index += len;
 }
@@ -95,13 +175,48 @@ void MemoryStream::write(const void* buffer, size_t len)
     }
 }
 
+void MemoryStream::writev(stdx::span<const StreamBuffer> buffers)
+{
+    size_t totalLen = 0;
+    for (const auto& buffer : buffers)
+    {
+        totalLen += buffer.len;
+    }
+    if (totalLen != 0)
+    {
+        ensureLength(_index + totalLen);
+        for (const auto& buffer : buffers)
+        {
+            if (buffer.len != 0)
+            {
+                std::memcpy(reinterpret_cast<void*>(reinterpret_cast<size_t>(_data.data()) + _index), buffer.data, buffer.len);
+                _index += buffer.len;
+            }
+        }
+    }
+}
+
 FileStream::FileStream(const fs::path path, uint8_t flags)
 {
     if (flags & StreamFlags::write)
     {
-        _fstream.open(path, std::ios::out | std::ios::binary);
+        auto openPath = path;
+        if (flags & StreamFlags::atomic)
+        {
+            _path = NativeFile::resolveTarget(path);
+            _tempPath = NativeFile::getTemporaryPath(_path);
+            {
+                // Create the temporary file with the permissions of the file it replaces
+                NativeFile file(_tempPath, StreamFlags::write);
+                file.copyPermissions(_path);
+            }
+            _uncaughtExceptions = std::uncaught_exceptions();
+            openPath = _tempPath;
+        }
+        _fstream.open(openPath, std::ios::out | std::ios::binary);
         if (!_fstream.is_open())
         {
+            discard();
             throw std::runtime_error("Failed to open '" + path.u8string() + "' for writing");
         }
         _reading = true;
@@ -118,6 +233,57 @@ FileStream::FileStream(const fs::path path, uint8_t flags)
     }
 }
 
+FileStream::~FileStream()
+{
+    if (!_tempPath.empty())
+    {
+        try
+        {
+            if (std::uncaught_exceptions() == _uncaughtExceptions)
+            {
+                commit();
+            }
+        }
+        catch (...)
+        {
+        }
+        discard();
+    }
+}
+
+void FileStream::commit()
+{
+    if (_tempPath.empty())
+        return;
+
+    try
+    {
+        _fstream.close();
+        if (_fstream.fail())
+            throw std::runtime_error(exceptionWriteError);
+
+        NativeFile::sync(_tempPath);
+        NativeFile::replace(_tempPath, _path);
+        _tempPath.clear();
+    }
+    catch (...)
+    {
+        discard();
+        throw;
+    }
+}
+
+void FileStream::discard()
+{
+    if (!_tempPath.empty())
+    {
+        _fstream.close();
+        std::error_code ec;
+        fs::remove(_tempPath, ec);
+        _tempPath.clear();
+    }
+}
+
 uint64_t FileStream::getLength() const
 {
     auto* fs = const_cast<std::fstream*>(&_fstream);
@@ -164,7 +330,7 @@ void FileStream::read(void* buffer, size_t len)
 {
     _fstream.read(static_cast<char*>(buffer), len);
     if (_fstream.fail())
-        throw std::runtime_error("Failed to read data");
+        throw std::runtime_error(exceptionReadError);
 }
 
 void FileStream::write(const void* buffer, size_t len)
@@ -173,24 +339,54 @@ void FileStream::write(const void* buffer, size_t len)
     {
         _fstream.write(static_cast<const char*>(buffer), len);
         if (_fstream.fail())
-            throw std::runtime_error("Failed to write data");
+            throw std::runtime_error(exceptionWriteError);
     }
 }
 
+void FileStream::flush()
+{
+    _fstream.flush();
+    if (_fstream.fail())
+        throw std::runtime_error(exceptionWriteError);
+}
+
 std::vector<std::byte> FileStream::readAllBytes(const fs::path& path)
 {
-    std::vector<std::byte> result;
-    FileStream fs(path, StreamFlags::read);
-    auto len = fs.getLength();
-    result.resize(len);
-    fs.read(result.data(), len);
+    NativeFile file(path, StreamFlags::read);
+    auto len = static_cast<size_t>(file.getSize());
+    std::vector<std::byte> result(len);
+    file.read(result.data(), len);
     return result;
 }
 
+void FileStream::readAllBytes(const fs::path& path, FastBuffer& buffer)
+{
+    NativeFile file(path, StreamFlags::read);
+    auto len = static_cast<size_t>(file.getSize());
+    buffer.resize(len);
+    file.read(buffer.data(), len);
+}
+
 void FileStream::writeAllBytes(const fs::path& path, const void* data, size_t len)
 {
-    FileStream fs(path, StreamFlags::write);
-    fs.write(data, len);
+    auto targetPath = NativeFile::resolveTarget(path);
+    auto tempPath = NativeFile::getTemporaryPath(targetPath);
+    try
+    {
+        {
+            NativeFile file(tempPath, StreamFlags::write);
+            file.copyPermissions(targetPath);
+            file.write(data, len);
+            file.sync();
+        }
+        NativeFile::replace(tempPath, targetPath);
+    }
+    catch (...)
+    {
+        std::error_code ec;
+        fs::remove(tempPath, ec);
+        throw;
+    }
 }
 
 std::string FileStream::readAllText(const fs::path& path)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "FastBuffer.h"
 #include "FileSystem.hpp"
 #include "Span.hpp"
 #include <cstddef>
@@ -14,8 +15,20 @@ namespace cs
     {
         constexpr uint8_t read = 1;
         constexpr uint8_t write = 2;
+
+        // Write to a temporary file which replaces the target file on commit
+        constexpr uint8_t atomic = 4;
     }
 
+    /**
+     * A contiguous block of memory, used to gather several blocks into a single write.
+     */
+    struct StreamBuffer
+    {
+        const void* data{};
+        size_t len{};
+    };
+
     class Stream
     {
     public:
@@ -25,6 +38,13 @@ namespace cs
         virtual void setPosition(uint64_t position) { throwInvalidOperation(); }
         virtual void read(void* buffer, size_t len) { throwInvalidOperation(); }
         virtual void write(const void* buffer, size_t len) { throwInvalidOperation(); }
+        virtual void flush() {}
+
+        /**
+         * Writes each buffer in order, as if write was called for each one. Streams
+         * override this when they can write all the buffers in a single operation.
+         */
+        virtual void writev(stdx::span<const StreamBuffer> buffers);
 
         void seek(int64_t pos);
 
@@ -53,6 +73,31 @@ namespace cs
         void read(void* buffer, size_t len) override;
     };
 
+    /**
+     * A window [offset, offset + len) of another stream with its own position. Reads and writes
+     * go straight to the parent stream, which is repositioned as required, so nested data can be
+     * parsed without copying it first. Writes can not extend beyond the window.
+     */
+    class SubStream final : public Stream
+    {
+    private:
+        Stream* _stream{};
+        uint64_t _offset{};
+        uint64_t _len{};
+        uint64_t _index{};
+
+        void seekParent();
+
+    public:
+        SubStream(Stream& stream, uint64_t offset, uint64_t len);
+        uint64_t getLength() const override;
+        uint64_t getPosition() const override;
+        void setPosition(uint64_t position) override;
+        void read(void* buffer, size_t len) override;
+        void write(const void* buffer, size_t len) override;
+        void flush() override;
+    };
+
     class MemoryStream final : public Stream
     {
     private:
@@ -69,6 +114,7 @@ namespace cs
         void setPosition(uint64_t position) override;
         void read(void* buffer, size_t len) override;
         void write(const void* buffer, size_t len) override;
+        void writev(stdx::span<const StreamBuffer> buffers) override;
 
         template<typename T>
         stdx::span<T> asSpan()
@@ -83,16 +129,44 @@ namespace cs
         std::fstream _fstream;
         bool _reading{};
         bool _writing{};
+        fs::path _path;
+        fs::path _tempPath;
+        int _uncaughtExceptions{};
+
+        void discard();
 
     public:
         FileStream(const fs::path path, uint8_t flags);
+        FileStream(const FileStream&) = delete;
+        FileStream& operator=(const FileStream&) = delete;
+        ~FileStream() override;
+
         uint64_t getLength() const override;
         uint64_t getPosition() const override;
         void setPosition(uint64_t position) override;
         void read(void* buffer, size_t len) override;
         void write(const void* buffer, size_t len) override;
+        void flush() override;
+
+        /**
+         * For streams opened with StreamFlags::atomic, closes and syncs the temporary file
+         * and then replaces the target file with it. If this is not called, the destructor
+         * commits unless it runs because of an exception, in which case the target is left
+         * untouched.
+         */
+        void commit();
 
         static std::vector<std::byte> readAllBytes(const fs::path& path);
+
+        /**
+         * Reads the whole file into the given buffer without initialising it first.
+         */
+        static void readAllBytes(const fs::path& path, FastBuffer& buffer);
+
+        /**
+         * Writes the data to a temporary file, syncs it to disk and then renames it over
+         * the target, so the target never contains partially written data.
+         */
         static void writeAllBytes(const fs::path& path, const void* data, size_t len);
         static std::string readAllText(const fs::path& path);
 
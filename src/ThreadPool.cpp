@@ -0,0 +1,69 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <memory>
+
+using namespace cs;
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    if (numThreads == 0)
+    {
+        numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+    _threads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        _threads.emplace_back([this]() { run(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+    for (auto& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::getNumThreads() const
+{
+    return _threads.size();
+}
+
+std::future<void> ThreadPool::enqueue(std::function<void()> fn)
+{
+    // std::function requires a copyable target, so the task is shared
+    auto task = std::make_shared<std::packaged_task<void()>>(std::move(fn));
+    auto result = task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.emplace_back([task]() { (*task)(); });
+    }
+    _cv.notify_one();
+    return result;
+}
+
+void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+            if (_queue.empty())
+            {
+                // Only reached when stopping, remaining tasks are always drained first
+                return;
+            }
+            fn = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        fn();
+    }
+}
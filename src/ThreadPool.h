@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cs
+{
+    /**
+     * A fixed set of worker threads which execute queued tasks in FIFO order.
+     * With a single thread, tasks are guaranteed to run in the order they were enqueued.
+     */
+    class ThreadPool final
+    {
+    private:
+        std::vector<std::thread> _threads;
+        std::deque<std::function<void()>> _queue;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stopping{};
+
+        void run();
+
+    public:
+        /**
+         * Creates a pool with the given number of threads, or one per hardware thread if 0.
+         */
+        ThreadPool(size_t numThreads = 0);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        size_t getNumThreads() const;
+        std::future<void> enqueue(std::function<void()> fn);
+    };
+}
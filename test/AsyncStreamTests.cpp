@@ -0,0 +1,98 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <sawyer/AsyncStream.h>
+#include <sawyer/SawyerStream.h>
+#include <vector>
+
+class AsyncStreamTests : public testing::TestWithParam<cs::AsyncBackend>
+{
+protected:
+    fs::path _path;
+
+    void SetUp() override
+    {
+        _path = fs::temp_directory_path() / "libsawyer_async_test.dat";
+    }
+
+    void TearDown() override
+    {
+        std::error_code ec;
+        fs::remove(_path, ec);
+    }
+
+    static std::vector<uint8_t> createData(size_t len)
+    {
+        std::vector<uint8_t> data(len);
+        for (size_t i = 0; i < len; i++)
+        {
+            data[i] = static_cast<uint8_t>((i * 7) ^ (i >> 8));
+        }
+        return data;
+    }
+};
+
+TEST_P(AsyncStreamTests, write_read)
+{
+    auto data = createData(10000);
+    {
+        // Small buffer so that many submissions are in flight
+        cs::AsyncFileStream stream(_path, cs::StreamFlags::write, GetParam(), 64);
+        for (size_t i = 0; i < data.size(); i += 100)
+        {
+            stream.write(data.data() + i, 100);
+        }
+        ASSERT_EQ(stream.getLength(), data.size());
+        ASSERT_EQ(stream.getPosition(), data.size());
+        stream.flush();
+    }
+
+    auto result = cs::FileStream::readAllBytes(_path);
+    ASSERT_EQ(result.size(), data.size());
+    ASSERT_EQ(std::memcmp(result.data(), data.data(), data.size()), 0);
+}
+
+TEST_P(AsyncStreamTests, seek_and_overwrite)
+{
+    cs::AsyncFileStream stream(_path, cs::StreamFlags::write, GetParam(), 16);
+    auto data = createData(100);
+    stream.write(data.data(), data.size());
+
+    uint32_t patch = 0xDEADBEEF;
+    stream.setPosition(10);
+    stream.write(&patch, sizeof(patch));
+    stream.setPosition(data.size());
+    ASSERT_EQ(stream.getLength(), data.size());
+
+    uint32_t readBack{};
+    stream.setPosition(10);
+    stream.read(&readBack, sizeof(readBack));
+    ASSERT_EQ(readBack, patch);
+    ASSERT_EQ(stream.getPosition(), 14);
+
+    uint8_t tail[4]{};
+    stream.setPosition(96);
+    stream.read(tail, sizeof(tail));
+    ASSERT_EQ(std::memcmp(tail, data.data() + 96, sizeof(tail)), 0);
+    ASSERT_THROW(stream.read(tail, 1), std::runtime_error);
+}
+
+TEST_P(AsyncStreamTests, sawyer_stream_writer)
+{
+    auto data = createData(5000);
+    {
+        cs::AsyncFileStream stream(_path, cs::StreamFlags::write, GetParam(), 256);
+        cs::SawyerStreamWriter writer(stream);
+        writer.writeChunk(cs::SawyerEncoding::runLengthSingle, data.data(), data.size());
+        writer.writeChecksum();
+        writer.close();
+    }
+
+    cs::SawyerStreamReader reader(_path);
+    ASSERT_TRUE(reader.validateChecksum());
+    auto chunk = reader.readChunk();
+    ASSERT_EQ(chunk.size(), data.size());
+    ASSERT_EQ(std::memcmp(chunk.data(), data.data(), data.size()), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AsyncStreamTests, testing::Values(cs::AsyncBackend::automatic, cs::AsyncBackend::threadPool));
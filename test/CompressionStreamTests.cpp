@@ -0,0 +1,107 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <sawyer/CompressionStream.h>
+#include <vector>
+
+using namespace cs;
+
+class CompressionStreamTests : public testing::TestWithParam<CompressionFormat>
+{
+protected:
+    void SetUp() override
+    {
+        if (!CompressingStream::isSupported(GetParam()))
+        {
+            GTEST_SKIP() << "Compression format not available";
+        }
+    }
+
+    static std::vector<uint8_t> createData(size_t len)
+    {
+        std::vector<uint8_t> data(len);
+        uint32_t seed = 1;
+        for (size_t i = 0; i < len; i++)
+        {
+            // Mix of runs and noise so the data compresses, but not trivially
+            seed = seed * 1103515245 + 12345;
+            data[i] = (i / 64) % 2 == 0 ? static_cast<uint8_t>(i / 64) : static_cast<uint8_t>(seed >> 16);
+        }
+        return data;
+    }
+};
+
+TEST_P(CompressionStreamTests, round_trip)
+{
+    auto data = createData(300000);
+
+    MemoryStream ms;
+    ms.write("HEAD", 4);
+    {
+        CompressingStream cs(ms, GetParam(), std::nullopt, 4096);
+        cs.write(data.data(), 1000);
+        cs.flush();
+        cs.write(data.data() + 1000, data.size() - 1000);
+        ASSERT_EQ(cs.getLength(), data.size());
+    }
+    ms.write("TAIL", 4);
+    ASSERT_LT(ms.getLength(), data.size());
+
+    ms.setPosition(4);
+    {
+        DecompressingStream ds(ms, GetParam(), 1000);
+        std::vector<uint8_t> result(data.size());
+        ds.read(result.data(), 5);
+        ds.setPosition(10);
+        ds.read(result.data() + 10, result.size() - 10);
+        ASSERT_EQ(std::memcmp(result.data() + 10, data.data() + 10, data.size() - 10), 0);
+
+        uint8_t extra;
+        ASSERT_EQ(ds.readSome(&extra, 1), 0);
+        ASSERT_THROW(ds.read(&extra, 1), std::runtime_error);
+    }
+
+    char tail[4];
+    ms.read(tail, 4);
+    ASSERT_EQ(std::memcmp(tail, "TAIL", 4), 0);
+}
+
+TEST_P(CompressionStreamTests, empty)
+{
+    MemoryStream ms;
+    {
+        CompressingStream cs(ms, GetParam());
+        cs.finish();
+        ASSERT_THROW(cs.write("a", 1), std::runtime_error);
+    }
+    ASSERT_GT(ms.getLength(), 0);
+
+    ms.setPosition(0);
+    DecompressingStream ds(ms, GetParam());
+    uint8_t buffer[16];
+    ASSERT_EQ(ds.readSome(buffer, sizeof(buffer)), 0);
+    ASSERT_EQ(ms.getPosition(), ms.getLength());
+}
+
+TEST_P(CompressionStreamTests, truncated)
+{
+    auto data = createData(10000);
+
+    MemoryStream ms;
+    {
+        CompressingStream cs(ms, GetParam());
+        cs.write(data.data(), data.size());
+    }
+
+    MemoryStream truncated;
+    truncated.write(ms.data(), static_cast<size_t>(ms.getLength() / 2));
+    truncated.setPosition(0);
+    DecompressingStream ds(truncated, GetParam());
+    std::vector<uint8_t> result(data.size());
+    ASSERT_THROW(ds.read(result.data(), result.size()), std::runtime_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    CompressionFormats, CompressionStreamTests, testing::Values(CompressionFormat::zlib, CompressionFormat::zstd),
+    [](const testing::TestParamInfo<CompressionFormat>& info) {
+        return info.param == CompressionFormat::zstd ? std::string("zstd") : std::string("zlib");
+    });
@@ -0,0 +1,300 @@
+#include <gtest/gtest.h>
+#include <sawyer/Gx.h>
+#include <vector>
+
+using namespace cs;
+
+class GxTests : public testing::Test
+{
+protected:
+    static constexpr int16_t imageWidth = 150;
+    static constexpr int16_t imageHeight = 20;
+
+    std::vector<uint8_t> _pixels;
+    MemoryStream _rle;
+    GxEntry _entry;
+
+    void SetUp() override
+    {
+        // Runs of various lengths, including ones longer than the maximum run length
+        _pixels.resize(imageWidth * imageHeight);
+        for (int32_t y = 0; y < imageHeight; y++)
+        {
+            for (int32_t x = 0; x < imageWidth; x++)
+            {
+                auto transparent = ((x + y * 7) % (y + 3)) == 0 || (x > 10 && x < 140 && y == 5);
+                _pixels[y * imageWidth + x] = transparent ? 0 : static_cast<uint8_t>(1 + (x + y) % 250);
+            }
+        }
+
+        GxEncoder encoder;
+        encoder.encodeRle({ imageWidth, imageHeight, _pixels.data() }, _rle);
+
+        _entry.offset = _rle.data();
+        _entry.width = imageWidth;
+        _entry.height = imageHeight;
+        _entry.flags = GxFlags::rle;
+    }
+
+    void assertDraw(int32_t surfaceWidth, int32_t surfaceHeight, int32_t x, int32_t y)
+    {
+        constexpr uint8_t background = 255;
+        constexpr int32_t padding = 3;
+        auto stride = surfaceWidth + padding;
+        std::vector<uint8_t> buffer(stride * surfaceHeight, background);
+
+        GxSurface surface;
+        surface.bits = buffer.data();
+        surface.width = surfaceWidth;
+        surface.height = surfaceHeight;
+        surface.stride = stride;
+        _entry.drawRle(surface, x, y);
+
+        for (int32_t dy = 0; dy < surfaceHeight; dy++)
+        {
+            for (int32_t dx = 0; dx < stride; dx++)
+            {
+                auto expected = background;
+                auto sx = dx - x;
+                auto sy = dy - y;
+                if (dx < surfaceWidth && sx >= 0 && sx < imageWidth && sy >= 0 && sy < imageHeight)
+                {
+                    auto p = _pixels[sy * imageWidth + sx];
+                    if (p != 0)
+                        expected = p;
+                }
+                ASSERT_EQ(buffer[dy * stride + dx], expected) << "at " << dx << ", " << dy;
+            }
+        }
+    }
+};
+
+TEST_F(GxTests, convert_rle_to_bmp)
+{
+    std::vector<uint8_t> bmp(_pixels.size());
+    _entry.convertToBmp(bmp.data());
+    ASSERT_EQ(bmp, _pixels);
+}
+
+TEST_F(GxTests, draw_rle)
+{
+    assertDraw(imageWidth, imageHeight, 0, 0);
+    assertDraw(200, 40, 20, 10);
+}
+
+TEST_F(GxTests, draw_rle_clipped)
+{
+    assertDraw(100, 10, 0, 0);
+    assertDraw(100, 10, -37, -6);
+    assertDraw(40, 30, 13, 25);
+    assertDraw(10, 10, -145, 0);
+    assertDraw(10, 10, 20, -30);
+    assertDraw(10, 10, 10, 10);
+}
+
+TEST_F(GxTests, draw_remap_zoom)
+{
+    uint8_t remap[256];
+    for (size_t i = 0; i < 256; i++)
+        remap[i] = static_cast<uint8_t>(255 - i);
+
+    GxEntry bmpEntry = _entry;
+    bmpEntry.offset = _pixels.data();
+    bmpEntry.flags = GxFlags::transparent;
+
+    for (auto entry : { _entry, bmpEntry })
+    {
+        entry.offsetX = -5;
+        entry.offsetY = 3;
+        for (uint8_t zoom = 0; zoom < 3; zoom++)
+        {
+            for (auto useRemap : { false, true })
+            {
+                constexpr int32_t surfaceWidth = 60;
+                constexpr int32_t surfaceHeight = 12;
+                constexpr int32_t x = -7;
+                constexpr int32_t y = -4;
+                std::vector<uint8_t> buffer(surfaceWidth * surfaceHeight, 1);
+
+                GxSurface surface;
+                surface.bits = buffer.data();
+                surface.width = surfaceWidth;
+                surface.height = surfaceHeight;
+                surface.stride = surfaceWidth;
+
+                GxDrawOptions options;
+                options.remap = useRemap ? remap : nullptr;
+                options.zoom = zoom;
+                entry.draw(surface, x, y, options);
+
+                for (int32_t dy = 0; dy < surfaceHeight; dy++)
+                {
+                    for (int32_t dx = 0; dx < surfaceWidth; dx++)
+                    {
+                        uint8_t expected = 1;
+                        auto sx = (dx << zoom) - (x + entry.offsetX);
+                        auto sy = (dy << zoom) - (y + entry.offsetY);
+                        if (sx >= 0 && sx < imageWidth && sy >= 0 && sy < imageHeight)
+                        {
+                            auto p = _pixels[sy * imageWidth + sx];
+                            if (p != 0)
+                                expected = useRemap ? remap[p] : p;
+                        }
+                        ASSERT_EQ(buffer[dy * surfaceWidth + dx], expected) << "at " << dx << ", " << dy << " zoom " << int(zoom);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_F(GxTests, draw_no_zoom)
+{
+    std::vector<uint8_t> buffer(imageWidth * imageHeight, 1);
+    GxSurface surface;
+    surface.bits = buffer.data();
+    surface.width = imageWidth;
+    surface.height = imageHeight;
+    surface.stride = imageWidth;
+
+    _entry.flags |= GxFlags::noZoom;
+    GxDrawOptions options;
+    options.zoom = 1;
+    _entry.draw(surface, 0, 0, options);
+    ASSERT_EQ(buffer, std::vector<uint8_t>(buffer.size(), 1));
+}
+
+TEST_F(GxTests, draw_from_set)
+{
+    // Entry 1 is drawn as entry 0 at higher zoom levels
+    const uint8_t full[] = { 1, 1, 1, 1 };
+    const uint8_t half[] = { 2, 2 };
+    GxEntry entries[2];
+    entries[0] = { half, 2, 1, 0, 0, GxFlags::noZoom };
+    entries[1] = { full, 4, 1, 0, 0, GxFlags::hasZoom, 1 };
+    auto getEntry = [&entries](uint32_t index) { return entries[index]; };
+
+    std::vector<uint8_t> buffer(8, 0);
+    GxSurface surface;
+    surface.bits = buffer.data();
+    surface.width = 8;
+    surface.height = 1;
+    surface.stride = 8;
+
+    GxEntry::drawFromSet(getEntry, 1, surface, 3, 0);
+    ASSERT_EQ(buffer, std::vector<uint8_t>({ 0, 0, 0, 1, 1, 1, 1, 0 }));
+
+    // Halving rounds down, so -1 is drawn at -1 rather than 0 at zoom 1
+    std::fill(buffer.begin(), buffer.end(), 0);
+    GxDrawOptions options;
+    options.zoom = 1;
+    GxEntry::drawFromSet(getEntry, 1, surface, 5, 0, options);
+    GxEntry::drawFromSet(getEntry, 1, surface, -1, 0, options);
+    ASSERT_EQ(buffer, std::vector<uint8_t>({ 2, 0, 2, 2, 0, 0, 0, 0 }));
+
+    // Entry 0 has noZoom, so nothing is drawn at zoom 2
+    std::fill(buffer.begin(), buffer.end(), 0);
+    options.zoom = 2;
+    GxEntry::drawFromSet(getEntry, 1, surface, 0, 0, options);
+    ASSERT_EQ(buffer, std::vector<uint8_t>(8, 0));
+}
+
+TEST_F(GxTests, encode_rle)
+{
+    // clang-format off
+    const uint8_t pixels[] = {
+        0, 0, 0, 0,
+        0, 5, 6, 0,
+        7, 0, 0, 8,
+    };
+    const uint8_t expected[] = {
+        6, 0, 8, 0, 14, 0,
+        0x80, 0,
+        2, 1, 5, 6, 0x80, 0,
+        1, 0, 7, 0x81, 3, 8,
+    };
+    // clang-format on
+
+    GxEncoder encoder;
+    FastBuffer buffer;
+    encoder.encodeRle({ 4, 3, pixels }, buffer);
+    ASSERT_EQ(std::vector<uint8_t>(buffer.data(), buffer.data() + buffer.size()), std::vector<uint8_t>(std::begin(expected), std::end(expected)));
+
+    MemoryStream ms;
+    encoder.encodeRle({ 4, 3, pixels }, ms);
+    ASSERT_EQ(ms.getLength(), sizeof(expected));
+}
+
+TEST_F(GxTests, encode_rle_maximum_runs)
+{
+    // Full length runs are never marked as the end of the row
+    std::vector<uint8_t> pixels(254, 9);
+    GxEncoder encoder;
+    FastBuffer buffer;
+    encoder.encodeRle({ 254, 1, pixels.data() }, buffer);
+    ASSERT_EQ(buffer.size(), 2 + 2 + 127 + 2 + 127 + 2);
+
+    auto data = buffer.data();
+    ASSERT_EQ(data[2], 127);
+    ASSERT_EQ(data[3], 0);
+    ASSERT_EQ(data[131], 127);
+    ASSERT_EQ(data[132], 127);
+    ASSERT_EQ(data[260], GxRleRowEndFlag);
+    ASSERT_EQ(data[261], 0);
+}
+
+TEST_F(GxTests, encode_smallest)
+{
+    GxEncoder encoder;
+    FastBuffer buffer;
+
+    // Mostly transparent, RLE is smaller
+    std::vector<uint8_t> sparse(64 * 64, 0);
+    sparse[100] = 1;
+    ASSERT_EQ(encoder.encodeSmallest({ 64, 64, sparse.data() }, buffer), GxFlags::transparent | GxFlags::rle);
+    FastBuffer rle;
+    encoder.encodeRle({ 64, 64, sparse.data() }, rle);
+    ASSERT_EQ(buffer.size(), rle.size());
+
+    // Alternating pixels, RLE is larger
+    std::vector<uint8_t> dense(64 * 64);
+    for (size_t i = 0; i < dense.size(); i++)
+        dense[i] = i % 2;
+    ASSERT_EQ(encoder.encodeSmallest({ 64, 64, dense.data() }, buffer), GxFlags::transparent);
+    ASSERT_EQ(std::vector<uint8_t>(buffer.data(), buffer.data() + buffer.size()), dense);
+}
+
+TEST_F(GxTests, encode_stride)
+{
+    // Encode the middle of a wider image and compare against the same pixels packed together
+    std::vector<uint8_t> wide(10 * 4, 0);
+    std::vector<uint8_t> packed(6 * 4, 0);
+    for (size_t y = 0; y < 4; y++)
+    {
+        for (size_t x = 0; x < 6; x++)
+        {
+            auto c = static_cast<uint8_t>((x + y) % 3 == 0 ? 0 : x + y * 6);
+            wide[y * 10 + x + 2] = c;
+            packed[y * 6 + x] = c;
+        }
+        wide[y * 10] = 0xFF;
+        wide[y * 10 + 9] = 0xFF;
+    }
+
+    GxEncoder encoder;
+    FastBuffer fromWide;
+    FastBuffer fromPacked;
+    encoder.encodeRle({ 6, 4, wide.data() + 2, 10 }, fromWide);
+    encoder.encodeRle({ 6, 4, packed.data() }, fromPacked);
+    ASSERT_EQ(fromWide.size(), fromPacked.size());
+    ASSERT_TRUE(std::equal(fromWide.data(), fromWide.data() + fromWide.size(), fromPacked.data()));
+    ASSERT_EQ(encoder.isWorthUsingRle({ 6, 4, wide.data() + 2, 10 }), encoder.isWorthUsingRle({ 6, 4, packed.data() }));
+
+    std::vector<uint8_t> dense(10 * 4, 0xFF);
+    for (size_t i = 0; i < dense.size(); i++)
+        dense[i] = i % 2;
+    ASSERT_EQ(encoder.encodeSmallest({ 6, 4, dense.data() + 2, 10 }, fromWide), GxFlags::transparent);
+    ASSERT_EQ(fromWide.size(), 6 * 4);
+    for (size_t y = 0; y < 4; y++)
+        ASSERT_TRUE(std::equal(fromWide.data() + y * 6, fromWide.data() + y * 6 + 6, dense.data() + y * 10 + 2));
+}
@@ -0,0 +1,335 @@
+#include <gtest/gtest.h>
+#include <sawyer/Image.h>
+#include <sawyer/ImageConverter.h>
+#include <sawyer/Stream.h>
+#include <sawyer/ThreadPool.h>
+
+using namespace cs;
+
+static Image createTestImage(uint32_t width, uint32_t height)
+{
+    Image image;
+    image.depth = 32;
+    image.width = width;
+    image.height = height;
+    image.stride = width * 4;
+    image.pixels.resize(image.stride * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto pixel = &image.pixels[y * image.stride + x * 4];
+            pixel[0] = static_cast<uint8_t>(x * 16);
+            pixel[1] = static_cast<uint8_t>(y * 16);
+            pixel[2] = static_cast<uint8_t>(x + y);
+            pixel[3] = 255;
+        }
+    }
+    return image;
+}
+
+TEST(ImageTests, slice)
+{
+    auto image = createTestImage(8, 6);
+    auto view = image.getView();
+    ASSERT_TRUE(view.contains(0, 0, 8, 6));
+    ASSERT_FALSE(view.contains(-1, 0, 2, 2));
+    ASSERT_FALSE(view.contains(7, 5, 2, 1));
+
+    auto slice = view.slice(2, 3, 4, 2);
+    ASSERT_EQ(slice.width, 4);
+    ASSERT_EQ(slice.height, 2);
+    ASSERT_EQ(slice.stride, image.stride);
+    ASSERT_EQ(slice.getRow(1), &image.pixels[4 * image.stride + 2 * 4]);
+    ASSERT_THROW(view.slice(6, 0, 4, 1), std::out_of_range);
+}
+
+TEST(ImageTests, crop)
+{
+    auto image = createTestImage(8, 6);
+    auto cropped = image.crop(2, 3, 4, 2);
+    auto fromView = Image::crop(image.getView().slice(2, 3, 4, 2), 0, 0, 4, 2);
+    ASSERT_EQ(cropped.stride, 16);
+    ASSERT_EQ(cropped.pixels, fromView.pixels);
+    for (uint32_t y = 0; y < 2; y++)
+    {
+        auto expected = &image.pixels[(y + 3) * image.stride + 2 * 4];
+        ASSERT_TRUE(std::equal(expected, expected + 16, &cropped.pixels[y * cropped.stride]));
+    }
+}
+
+TEST(ImageTests, crop_outside)
+{
+    auto image = createTestImage(4, 4);
+    auto cropped = image.crop(-1, 2, 6, 4);
+    for (uint32_t y = 0; y < 4; y++)
+    {
+        for (uint32_t x = 0; x < 6; x++)
+        {
+            auto pixel = &cropped.pixels[y * cropped.stride + x * 4];
+            auto inside = x >= 1 && x < 5 && y < 2;
+            auto expected = inside ? &image.pixels[(y + 2) * image.stride + (x - 1) * 4] : nullptr;
+            for (int c = 0; c < 4; c++)
+                ASSERT_EQ(pixel[c], inside ? expected[c] : 0);
+        }
+    }
+}
+
+TEST(ImageTests, convert_view)
+{
+    auto image = createTestImage(8, 6);
+    Palette palette{};
+    for (int i = 0; i < 256; i++)
+        palette.Colour[i] = { static_cast<uint8_t>(i), static_cast<uint8_t>(255 - i), static_cast<uint8_t>(i / 2), 255 };
+
+    ImageConverter converter;
+    auto fromView = converter.convertTo8bpp(image.getView().slice(1, 2, 5, 3), ImageConverter::ConvertMode::Dithering, palette);
+    auto fromCopy = converter.convertTo8bpp(image.crop(1, 2, 5, 3), ImageConverter::ConvertMode::Dithering, palette);
+    ASSERT_EQ(fromView.width, 5);
+    ASSERT_EQ(fromView.height, 3);
+    ASSERT_EQ(fromView.pixels, fromCopy.pixels);
+}
+
+TEST(ImageTests, convert_parallel)
+{
+    auto image = createTestImage(300, 120);
+    Palette palette{};
+    for (int i = 0; i < 256; i++)
+        palette.Colour[i] = { static_cast<uint8_t>(i * 7), static_cast<uint8_t>(i * 3), static_cast<uint8_t>(i), 255 };
+
+    ThreadPool threadPool(4);
+    ImageConverter serial;
+    ImageConverter parallel(threadPool);
+    for (auto mode : { ImageConverter::ConvertMode::Default, ImageConverter::ConvertMode::Closest, ImageConverter::ConvertMode::Dithering })
+    {
+        auto expected = serial.convertTo8bpp(image, mode, palette);
+        for (int i = 0; i < 4; i++)
+        {
+            auto actual = parallel.convertTo8bpp(image, mode, palette);
+            ASSERT_EQ(actual.pixels, expected.pixels);
+        }
+    }
+}
+
+TEST(ImageTests, convert_statistics)
+{
+    // Three opaque colours repeated, plus transparent pixels which are not looked up
+    auto image = createTestImage(16, 8);
+    for (uint32_t i = 0; i < image.width * image.height; i++)
+    {
+        auto pixel = &image.pixels[i * 4];
+        pixel[0] = static_cast<uint8_t>((i % 4) * 50);
+        pixel[1] = 10;
+        pixel[2] = 20;
+        pixel[3] = i % 4 == 3 ? 0 : 255;
+    }
+    Palette palette{};
+    palette.Colour[20] = { 20, 10, 0, 255 };
+
+    ImageConverter converter;
+    auto result = converter.convertTo8bpp(image, ImageConverter::ConvertMode::Closest, palette);
+    ASSERT_EQ(result.pixels[0], 20);
+    ASSERT_EQ(result.pixels[3], 0);
+    auto statistics = converter.getStatistics();
+    ASSERT_EQ(statistics.memoLookups, 96);
+    ASSERT_EQ(statistics.memoHits, 93);
+
+    converter.resetStatistics();
+    converter.convertTo8bpp(image, ImageConverter::ConvertMode::Dithering, palette);
+    ASSERT_EQ(converter.getStatistics().memoLookups, 0);
+}
+
+TEST(ImageTests, convert_batch)
+{
+    Palette palette{};
+    for (int i = 0; i < 256; i++)
+        palette.Colour[i] = { static_cast<uint8_t>(i * 5), static_cast<uint8_t>(i), static_cast<uint8_t>(i * 11), 255 };
+
+    std::vector<Image> images;
+    for (uint32_t i = 0; i < 12; i++)
+        images.push_back(createTestImage(4 + i * 3, 3 + i));
+    std::vector<ImageView> views;
+    for (const auto& image : images)
+        views.push_back(image.getView());
+
+    ThreadPool threadPool(3);
+    ImageConverter unbound;
+    ImageConverter bound(palette, threadPool);
+    for (auto mode : { ImageConverter::ConvertMode::Closest, ImageConverter::ConvertMode::Dithering })
+    {
+        auto results = bound.convertTo8bpp(views, mode);
+        ASSERT_EQ(results.size(), images.size());
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            auto expected = unbound.convertTo8bpp(images[i], mode, palette);
+            ASSERT_EQ(results[i].width, expected.width);
+            ASSERT_EQ(results[i].pixels, expected.pixels);
+            ASSERT_EQ(bound.convertTo8bpp(views[i], mode).pixels, expected.pixels);
+        }
+    }
+    ASSERT_THROW(unbound.convertTo8bpp(views, ImageConverter::ConvertMode::Closest), std::runtime_error);
+}
+
+TEST(ImageTests, png_depth)
+{
+    auto image = createTestImage(7, 5);
+    Palette palette{};
+    for (int i = 0; i < 256; i++)
+        palette.Colour[i] = { static_cast<uint8_t>(i), static_cast<uint8_t>(i / 2), static_cast<uint8_t>(255 - i), 255 };
+    ImageConverter converter;
+    auto indexed = converter.convertTo8bpp(image, ImageConverter::ConvertMode::Closest, palette);
+    indexed.palette = std::make_shared<Palette>(palette);
+
+    MemoryStream ms;
+    indexed.toPng(ms);
+
+    ms.setPosition(0);
+    auto fromPng = Image::fromPng(ms);
+    ASSERT_EQ(fromPng.depth, 8);
+    ASSERT_EQ(fromPng.width, 7);
+    ASSERT_EQ(fromPng.height, 5);
+    ASSERT_EQ(fromPng.pixels, indexed.pixels);
+
+    // Expanded through the palette, where index 0 is written as transparent
+    for (auto depth : { 24u, 32u })
+    {
+        ms.setPosition(0);
+        auto expanded = Image::fromPng(ms, depth);
+        ASSERT_EQ(expanded.depth, depth);
+        ASSERT_EQ(expanded.stride, 7 * depth / 8);
+        for (size_t i = 0; i < indexed.pixels.size(); i++)
+        {
+            auto index = indexed.pixels[i];
+            auto pixel = &expanded.pixels[i * (depth / 8)];
+            ASSERT_EQ(pixel[0], palette.Colour[index].Red);
+            ASSERT_EQ(pixel[1], palette.Colour[index].Green);
+            ASSERT_EQ(pixel[2], palette.Colour[index].Blue);
+            if (depth == 32)
+            {
+                ASSERT_EQ(pixel[3], index == 0 ? 0 : 255);
+            }
+        }
+    }
+
+    // 32-bit images round trip and can not be read as 8bpp
+    MemoryStream ms32;
+    image.toPng(ms32);
+    ms32.setPosition(0);
+    ASSERT_EQ(Image::fromPng(ms32).pixels, image.pixels);
+    ms32.setPosition(0);
+    ASSERT_THROW(Image::fromPng(ms32, 8), std::runtime_error);
+}
+
+TEST(ImageTests, png_options)
+{
+    auto image = createTestImage(40, 30);
+    auto options = PngOptions::fast();
+    for (auto filters : { PngFilters::none, PngFilters::paeth, PngFilters::all })
+    {
+        options.filters = filters;
+        MemoryStream ms;
+        image.toPng(ms, options);
+        ms.setPosition(0);
+        ASSERT_EQ(Image::fromPng(ms).pixels, image.pixels);
+    }
+
+    options.compressionLevel = 9;
+    options.strategy = PngStrategy::rle;
+    MemoryStream ms;
+    image.toPng(ms, options);
+    ms.setPosition(0);
+    ASSERT_EQ(Image::fromPng(ms).pixels, image.pixels);
+}
+
+TEST(ImageTests, png_trim_palette)
+{
+    auto palette = std::make_shared<Palette>();
+    for (int i = 0; i < 256; i++)
+        palette->Colour[i] = { static_cast<uint8_t>(i), static_cast<uint8_t>(i * 3), static_cast<uint8_t>(i * 5), 255 };
+
+    Image image;
+    image.width = 9;
+    image.height = 4;
+    image.depth = 8;
+    image.stride = 12;
+    image.palette = palette;
+    image.pixels.resize(image.stride * image.height);
+    for (uint32_t i = 0; i < image.width * image.height; i++)
+        image.pixels[(i / image.width) * image.stride + i % image.width] = static_cast<uint8_t>(i % 7);
+
+    // Bytes past the width of each row are not part of the image
+    image.pixels[10] = 200;
+
+    MemoryStream full;
+    image.toPng(full);
+    PngOptions options;
+    options.trimPalette = true;
+    MemoryStream trimmed;
+    image.toPng(trimmed, options);
+    ASSERT_LT(trimmed.getLength(), full.getLength());
+
+    trimmed.setPosition(0);
+    auto result = Image::fromPng(trimmed);
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        for (uint32_t x = 0; x < image.width; x++)
+        {
+            auto index = result.pixels[y * result.stride + x];
+            ASSERT_EQ(index, image.pixels[y * image.stride + x]);
+            ASSERT_EQ(result.palette->Colour[index].Green, palette->Colour[index].Green);
+        }
+    }
+    ASSERT_EQ(result.palette->Colour[7].Green, 0);
+}
+
+TEST(ImageTests, convert_streaming)
+{
+    // Even columns of the test image are in the palette, odd columns are not
+    Palette palette{};
+    for (int i = 0; i < 256; i++)
+    {
+        auto x = i % 16;
+        auto y = i / 16;
+        auto& colour = palette.Colour[i];
+        colour.Red = static_cast<uint8_t>(x % 2 == 0 ? x * 16 : i * 7);
+        colour.Green = static_cast<uint8_t>(x % 2 == 0 ? y * 16 : i * 3);
+        colour.Blue = static_cast<uint8_t>(x % 2 == 0 ? x + y : i);
+        colour.Alpha = 255;
+    }
+
+    // Results of converting with the whole image loaded into a work buffer up front
+    struct Expected
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> pixels[3];
+    };
+    // clang-format off
+    const Expected expected[] = {
+        { 7, 5, {
+            { 0, 0, 2, 0, 4, 0, 6, 16, 0, 18, 0, 20, 0, 22, 32, 0, 34, 0, 36, 0, 38, 48, 0, 50, 0, 52, 0, 54, 64, 0, 66, 0, 68, 0, 70 },
+            { 16, 16, 2, 18, 4, 20, 6, 16, 16, 18, 18, 20, 20, 22, 32, 32, 34, 34, 36, 11, 38, 48, 48, 50, 50, 52, 13, 54, 64, 64, 66, 66, 68, 68, 70 },
+            { 16, 16, 2, 18, 4, 20, 6, 16, 18, 18, 20, 20, 22, 22, 32, 32, 34, 34, 36, 11, 38, 48, 48, 50, 50, 52, 13, 54, 64, 64, 66, 66, 68, 68, 70 } } },
+        { 1, 6, {
+            { 0, 16, 32, 48, 64, 80 },
+            { 16, 16, 32, 48, 64, 80 },
+            { 16, 16, 32, 48, 64, 80 } } },
+        { 9, 1, {
+            { 0, 0, 2, 0, 4, 0, 6, 0, 8 },
+            { 16, 16, 2, 18, 4, 20, 6, 22, 8 },
+            { 16, 16, 2, 18, 4, 20, 6, 22, 8 } } },
+        { 1, 1, { { 0 }, { 16 }, { 16 } } },
+    };
+    // clang-format on
+
+    ImageConverter converter;
+    for (const auto& e : expected)
+    {
+        auto image = createTestImage(e.width, e.height);
+        for (auto mode : { ImageConverter::ConvertMode::Default, ImageConverter::ConvertMode::Closest, ImageConverter::ConvertMode::Dithering })
+        {
+            auto result = converter.convertTo8bpp(image, mode, palette);
+            ASSERT_EQ(result.pixels, e.pixels[static_cast<int>(mode)]) << e.width << "x" << e.height << " mode " << static_cast<int>(mode);
+        }
+    }
+}
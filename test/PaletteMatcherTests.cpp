@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <sawyer/PaletteMatcher.h>
+
+using namespace cs;
+
+static Palette createRandomPalette(std::mt19937& rng)
+{
+    Palette palette;
+    for (auto& colour : palette.Colour)
+    {
+        colour.Red = static_cast<uint8_t>(rng());
+        colour.Green = static_cast<uint8_t>(rng());
+        colour.Blue = static_cast<uint8_t>(rng());
+        colour.Alpha = 255;
+    }
+    return palette;
+}
+
+static PaletteIndex findClosestSlow(const Palette& palette, const std::bitset<PaletteSize>& candidates, int32_t r, int32_t g, int32_t b)
+{
+    auto smallestError = std::numeric_limits<uint32_t>::max();
+    PaletteIndex bestMatch = 0;
+    for (int32_t i = 0; i < PaletteSize; i++)
+    {
+        if (!candidates[i])
+            continue;
+
+        auto dr = palette.Colour[i].Red - r;
+        auto dg = palette.Colour[i].Green - g;
+        auto db = palette.Colour[i].Blue - b;
+        auto error = static_cast<uint32_t>(dr * dr) + static_cast<uint32_t>(dg * dg) + static_cast<uint32_t>(db * db);
+        if (error < smallestError)
+        {
+            smallestError = error;
+            bestMatch = static_cast<PaletteIndex>(i);
+        }
+    }
+    return bestMatch;
+}
+
+TEST(PaletteMatcherTests, find_exact)
+{
+    std::mt19937 rng(1);
+    auto palette = createRandomPalette(rng);
+    palette.Colour[200] = palette.Colour[100];
+
+    PaletteMatcher matcher(palette, {});
+    for (int32_t i = 0; i < PaletteSize; i++)
+    {
+        const auto& colour = palette.Colour[i];
+        auto index = matcher.findExact(colour.Red, colour.Green, colour.Blue);
+        ASSERT_TRUE(index.has_value());
+        ASSERT_EQ(palette.Colour[*index].Red, colour.Red);
+        ASSERT_EQ(palette.Colour[*index].Green, colour.Green);
+        ASSERT_EQ(palette.Colour[*index].Blue, colour.Blue);
+        ASSERT_LE(*index, i);
+    }
+    ASSERT_EQ(matcher.findExact(palette.Colour[200].Red, palette.Colour[200].Green, palette.Colour[200].Blue), 100);
+    ASSERT_EQ(matcher.findExact(-1, 0, 0), std::nullopt);
+    ASSERT_EQ(matcher.findExact(256, 0, 0), std::nullopt);
+}
+
+TEST(PaletteMatcherTests, find_closest)
+{
+    std::mt19937 rng(2);
+    auto palette = createRandomPalette(rng);
+
+    // Duplicates and a small palette subset check ties go to the lowest index
+    palette.Colour[150] = palette.Colour[40];
+    std::bitset<PaletteSize> candidates;
+    for (int32_t i = 10; i < PaletteSize; i += 3)
+        candidates[i] = true;
+
+    // Colours outside the RGB cube are found by each kernel the CPU supports
+    PaletteMatcher matcher(palette, candidates);
+    for (auto kernel : { PaletteSearchKernel::scalar, PaletteSearchKernel::sse41, PaletteSearchKernel::avx2 })
+    {
+        if (!PaletteMatcher::isKernelSupported(kernel))
+        {
+            ASSERT_THROW(matcher.setKernel(kernel), std::runtime_error);
+            continue;
+        }
+
+        matcher.setKernel(kernel);
+        std::uniform_int_distribution<int32_t> dist(-64, 320);
+        for (int32_t i = 0; i < 100000; i++)
+        {
+            auto r = dist(rng);
+            auto g = dist(rng);
+            auto b = dist(rng);
+            ASSERT_EQ(matcher.findClosest(r, g, b), findClosestSlow(palette, candidates, r, g, b)) << "kernel " << static_cast<int>(kernel);
+        }
+
+        // Errors of this size only fit in unsigned 32-bit values
+        ASSERT_EQ(matcher.findClosest(-32768, 32767, -32768), findClosestSlow(palette, candidates, -32768, 32767, -32768));
+        ASSERT_EQ(matcher.findClosest(32767, 32767, 32767), findClosestSlow(palette, candidates, 32767, 32767, 32767));
+    }
+}
+
+TEST(PaletteMatcherTests, no_candidates)
+{
+    std::mt19937 rng(3);
+    PaletteMatcher matcher(createRandomPalette(rng), {});
+    ASSERT_EQ(matcher.findClosest(10, 20, 30), 0);
+}
+
+TEST(PaletteMatcherTests, perceptual_distance)
+{
+    // Entry 1 is closer in RGB, but entry 2 is perceptually closer to the grey
+    Palette palette{};
+    palette.Colour[1] = { 120, 230, 110, 255 };
+    palette.Colour[2] = { 250, 180, 20, 255 };
+    palette.Colour[3] = { 100, 100, 100, 255 };
+    std::bitset<PaletteSize> candidates;
+    candidates[1] = true;
+    candidates[2] = true;
+
+    ASSERT_EQ(PaletteMatcher(palette, candidates).findClosest(100, 100, 100), 1);
+    for (auto distance : { ColourDistance::cielab, ColourDistance::oklab })
+    {
+        PaletteMatcher matcher(palette, candidates, distance);
+        ASSERT_EQ(matcher.findClosest(100, 100, 100), 2);
+        ASSERT_EQ(matcher.findClosest(-50, 400, 100), matcher.findClosest(0, 255, 100));
+        ASSERT_EQ(matcher.findExact(100, 100, 100), 3);
+    }
+}
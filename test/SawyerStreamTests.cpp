@@ -98,6 +98,42 @@ TEST_F(SawyerStreamTests, decode_chunk_rotate)
     assertDecode(stdx::span{ rotatedata }, stdx::span{ randomdata });
 }
 
+TEST_F(SawyerStreamTests, read_chunk_stream)
+{
+    cs::MemoryStream stream;
+    cs::SawyerStreamWriter writer(stream);
+    writer.writeChunk(cs::SawyerEncoding::uncompressed, randomdata, 100);
+    uint32_t marker = 0x12345678;
+    writer.write(&marker, sizeof(marker));
+    writer.writeChunk(cs::SawyerEncoding::runLengthMulti, randomdata, sizeof(randomdata));
+    writer.writeChecksum();
+    writer.close();
+
+    stream.setPosition(0);
+    cs::SawyerStreamReader reader(stream);
+
+    // Only read part of the first chunk, the next chunk must still be found
+    auto& chunk0 = reader.readChunkStream();
+    ASSERT_EQ(chunk0.getLength(), 100);
+    uint8_t buffer[sizeof(randomdata)];
+    chunk0.setPosition(10);
+    chunk0.read(buffer, 20);
+    ASSERT_EQ(std::memcmp(buffer, randomdata + 10, 20), 0);
+
+    // Reading from the reader continues after the chunk, and the chunk can still be read after
+    uint32_t readMarker{};
+    reader.read(&readMarker, sizeof(readMarker));
+    ASSERT_EQ(readMarker, marker);
+    chunk0.read(buffer, 20);
+    ASSERT_EQ(std::memcmp(buffer, randomdata + 30, 20), 0);
+
+    auto& chunk1 = reader.readChunkStream();
+    ASSERT_EQ(chunk1.getLength(), sizeof(randomdata));
+    chunk1.read(buffer, sizeof(buffer));
+    ASSERT_EQ(std::memcmp(buffer, randomdata, sizeof(randomdata)), 0);
+    ASSERT_TRUE(reader.validateChecksum());
+}
+
 TEST_F(SawyerStreamTests, DISABLED_invalid1)
 {
     assertDecodeException(stdx::span{ invalid1 });
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <sawyer/SpriteCache.h>
+#include <vector>
+
+using namespace cs;
+
+class SpriteCacheTests : public testing::Test
+{
+protected:
+    // Entries 0-3 are 4x4 bitmaps filled with their index + 1, entry 4 is a palette and
+    // entry 5 is an 8x8 bitmap which uses entry 3 for higher zoom levels
+    std::vector<std::vector<uint8_t>> _pixels;
+    std::vector<GxEntry> _entries;
+    uint32_t _numDecodes{};
+
+    void SetUp() override
+    {
+        for (uint8_t i = 0; i < 6; i++)
+        {
+            auto size = i == 5 ? 8 : 4;
+            _pixels.emplace_back(size * size, static_cast<uint8_t>(i + 1));
+            GxEntry entry;
+            entry.offset = _pixels.back().data();
+            entry.width = size;
+            entry.height = size;
+            _entries.push_back(entry);
+        }
+        _entries[4].flags = GxFlags::isPalette;
+        _entries[5].flags = GxFlags::hasZoom;
+        _entries[5].zoomOffset = 2;
+    }
+
+    SpriteCache createCache(size_t budget)
+    {
+        return SpriteCache(
+            [this](uint32_t index) {
+                _numDecodes++;
+                return _entries[index];
+            },
+            static_cast<uint32_t>(_entries.size()), budget);
+    }
+};
+
+TEST_F(SpriteCacheTests, get)
+{
+    auto cache = createCache(SpriteCache::defaultBudget);
+    auto sprite = cache.get(1);
+    ASSERT_EQ(sprite->width, 4);
+    ASSERT_EQ(sprite->height, 4);
+    ASSERT_EQ(sprite->pixels, _pixels[1]);
+    ASSERT_EQ(cache.getUsage(), 16);
+
+    // The second get is served from the cache
+    auto decodes = _numDecodes;
+    ASSERT_EQ(cache.get(1), sprite);
+    ASSERT_EQ(_numDecodes, decodes);
+}
+
+TEST_F(SpriteCacheTests, zoom)
+{
+    auto cache = createCache(SpriteCache::defaultBudget);
+
+    // Entry 5 is replaced by entry 3 at zoom 1 and entry 3 is downsampled at zoom 2
+    auto zoom1 = cache.get(5, 1);
+    ASSERT_EQ(zoom1->width, 4);
+    ASSERT_EQ(zoom1->pixels, _pixels[3]);
+    auto zoom2 = cache.get(5, 2);
+    ASSERT_EQ(zoom2->width, 2);
+    ASSERT_EQ(zoom2->pixels, std::vector<uint8_t>(4, 4));
+
+    auto zoom1Plain = cache.get(1, 1);
+    ASSERT_EQ(zoom1Plain->width, 2);
+    ASSERT_EQ(zoom1Plain->pixels, std::vector<uint8_t>(4, 2));
+    ASSERT_TRUE(cache.contains(5, 1));
+    ASSERT_FALSE(cache.contains(5, 0));
+}
+
+TEST_F(SpriteCacheTests, evict_least_recently_used)
+{
+    // Room for two 4x4 sprites
+    auto cache = createCache(32);
+    auto sprite0 = cache.get(0);
+    cache.get(1);
+    cache.get(0);
+    cache.get(2);
+    ASSERT_TRUE(cache.contains(0));
+    ASSERT_FALSE(cache.contains(1));
+    ASSERT_TRUE(cache.contains(2));
+    ASSERT_EQ(cache.getUsage(), 32);
+
+    // Evicted sprites stay valid while held
+    cache.get(3);
+    cache.get(1);
+    ASSERT_FALSE(cache.contains(0));
+    ASSERT_EQ(sprite0->pixels, _pixels[0]);
+
+    // The most recently used sprite is kept even when it is over the budget
+    auto large = cache.get(5);
+    ASSERT_EQ(large->pixels, _pixels[5]);
+    ASSERT_TRUE(cache.contains(5));
+    ASSERT_EQ(cache.getUsage(), 64);
+
+    cache.clear();
+    ASSERT_EQ(cache.getUsage(), 0);
+    ASSERT_FALSE(cache.contains(5));
+}
+
+TEST_F(SpriteCacheTests, prefetch)
+{
+    // Room for three 4x4 sprites, prefetching stops before evicting anything
+    auto cache = createCache(48);
+    cache.get(0);
+    cache.prefetch(1, 10);
+    ASSERT_TRUE(cache.contains(0));
+    ASSERT_TRUE(cache.contains(1));
+    ASSERT_TRUE(cache.contains(2));
+    ASSERT_FALSE(cache.contains(3));
+    ASSERT_EQ(cache.getUsage(), 48);
+
+    // Palettes are skipped and the range is clipped to the entries
+    cache.clear();
+    cache.prefetch(3, 10);
+    ASSERT_TRUE(cache.contains(3));
+    ASSERT_FALSE(cache.contains(4));
+    ASSERT_FALSE(cache.contains(5));
+
+    auto decodes = _numDecodes;
+    ASSERT_EQ(cache.get(3)->pixels, _pixels[3]);
+    ASSERT_EQ(_numDecodes, decodes);
+}
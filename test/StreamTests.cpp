@@ -0,0 +1,184 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <sawyer/Stream.h>
+
+class StreamTests : public testing::Test
+{
+protected:
+    fs::path _path;
+
+    void SetUp() override
+    {
+        _path = fs::temp_directory_path() / "libsawyer_stream_test.dat";
+    }
+
+    void TearDown() override
+    {
+        std::error_code ec;
+        fs::remove(_path, ec);
+    }
+};
+
+TEST_F(StreamTests, memory_stream_writev)
+{
+    const char a[] = "Hello";
+    const char b[] = ", ";
+    const char c[] = "World";
+    cs::StreamBuffer buffers[] = {
+        { a, 5 },
+        { b, 2 },
+        { nullptr, 0 },
+        { c, 5 },
+    };
+
+    cs::MemoryStream ms;
+    ms.write("#", 1);
+    ms.writev(buffers);
+    ASSERT_EQ(ms.getLength(), 13);
+    ASSERT_EQ(ms.getPosition(), 13);
+    ASSERT_EQ(std::memcmp(ms.data(), "#Hello, World", 13), 0);
+
+    // Overwrite in the middle without changing the length
+    ms.setPosition(1);
+    ms.writev(stdx::span(buffers, 2));
+    ASSERT_EQ(ms.getLength(), 13);
+    ASSERT_EQ(ms.getPosition(), 8);
+}
+
+TEST_F(StreamTests, file_stream_writev)
+{
+    uint32_t header = 0x12345678;
+    uint8_t payload[300];
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = static_cast<uint8_t>(i);
+
+    {
+        cs::StreamBuffer buffers[] = {
+            { &header, sizeof(header) },
+            { payload, sizeof(payload) },
+        };
+        cs::FileStream fs(_path, cs::StreamFlags::write);
+        fs.writev(buffers);
+    }
+
+    auto result = cs::FileStream::readAllBytes(_path);
+    ASSERT_EQ(result.size(), sizeof(header) + sizeof(payload));
+    ASSERT_EQ(std::memcmp(result.data(), &header, sizeof(header)), 0);
+    ASSERT_EQ(std::memcmp(result.data() + sizeof(header), payload, sizeof(payload)), 0);
+}
+
+TEST_F(StreamTests, read_all_bytes_fast_buffer)
+{
+    const char text[] = "The quick brown fox";
+    cs::FileStream::writeAllBytes(_path, text, sizeof(text));
+
+    cs::FastBuffer buffer;
+    cs::FileStream::readAllBytes(_path, buffer);
+    ASSERT_EQ(buffer.size(), sizeof(text));
+    ASSERT_EQ(std::memcmp(buffer.data(), text, sizeof(text)), 0);
+}
+
+TEST_F(StreamTests, write_all_bytes_replaces)
+{
+    cs::FileStream::writeAllText(_path, "first version which is long");
+    cs::FileStream::writeAllText(_path, "second");
+    ASSERT_EQ(cs::FileStream::readAllText(_path), "second");
+
+    // No temporary files should be left behind
+    auto tempCount = 0;
+    for (const auto& entry : fs::directory_iterator(_path.parent_path()))
+    {
+        auto name = entry.path().filename().u8string();
+        if (name.find(_path.filename().u8string() + ".") == 0)
+            tempCount++;
+    }
+    ASSERT_EQ(tempCount, 0);
+}
+
+TEST_F(StreamTests, atomic_file_stream_discards_on_exception)
+{
+    cs::FileStream::writeAllText(_path, "original");
+    try
+    {
+        cs::FileStream fs(_path, cs::StreamFlags::write | cs::StreamFlags::atomic);
+        fs.write("partial", 7);
+        throw std::runtime_error("save failed");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    ASSERT_EQ(cs::FileStream::readAllText(_path), "original");
+
+    {
+        cs::FileStream fs(_path, cs::StreamFlags::write | cs::StreamFlags::atomic);
+        fs.write("replaced", 8);
+        ASSERT_EQ(cs::FileStream::readAllText(_path), "original");
+        fs.commit();
+    }
+    ASSERT_EQ(cs::FileStream::readAllText(_path), "replaced");
+}
+
+#ifndef _WIN32
+TEST_F(StreamTests, replace_keeps_permissions)
+{
+    constexpr auto permissions = fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read;
+    cs::FileStream::writeAllText(_path, "original");
+    fs::permissions(_path, permissions);
+
+    cs::FileStream::writeAllText(_path, "second");
+    ASSERT_EQ(fs::status(_path).permissions(), permissions);
+
+    {
+        cs::FileStream fs(_path, cs::StreamFlags::write | cs::StreamFlags::atomic);
+        fs.write("third", 5);
+    }
+    ASSERT_EQ(fs::status(_path).permissions(), permissions);
+    ASSERT_EQ(cs::FileStream::readAllText(_path), "third");
+}
+
+TEST_F(StreamTests, replace_follows_symlink)
+{
+    auto linkPath = fs::temp_directory_path() / "libsawyer_stream_test.lnk";
+    std::error_code ec;
+    fs::remove(linkPath, ec);
+    cs::FileStream::writeAllText(_path, "original");
+    fs::create_symlink(_path, linkPath);
+
+    cs::FileStream::writeAllText(linkPath, "second");
+    {
+        cs::FileStream fs(linkPath, cs::StreamFlags::write | cs::StreamFlags::atomic);
+        fs.write("third", 5);
+    }
+    auto isLink = fs::is_symlink(linkPath);
+    fs::remove(linkPath, ec);
+    ASSERT_TRUE(isLink);
+    ASSERT_EQ(cs::FileStream::readAllText(_path), "third");
+}
+#endif
+
+TEST_F(StreamTests, sub_stream)
+{
+    cs::MemoryStream ms;
+    ms.write("0123456789", 10);
+
+    cs::SubStream sub(ms, 2, 5);
+    ASSERT_EQ(sub.getLength(), 5);
+
+    char buffer[5];
+    sub.read(buffer, 3);
+    ASSERT_EQ(std::memcmp(buffer, "234", 3), 0);
+
+    // Parent position is independent of the sub stream
+    ms.setPosition(0);
+    sub.read(buffer, 2);
+    ASSERT_EQ(std::memcmp(buffer, "56", 2), 0);
+    ASSERT_THROW(sub.read(buffer, 1), std::runtime_error);
+
+    sub.setPosition(1);
+    sub.write("ab", 2);
+    ASSERT_THROW(sub.write("cdef", 4), std::runtime_error);
+    ASSERT_EQ(std::memcmp(ms.data(), "012ab56789", 10), 0);
+
+    ASSERT_THROW(sub.setPosition(6), std::out_of_range);
+    ASSERT_THROW(cs::SubStream(ms, 8, 5), std::out_of_range);
+}
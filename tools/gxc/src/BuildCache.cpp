@@ -0,0 +1,160 @@
+#include "BuildCache.h"
+#include <sawyer/FastBuffer.h>
+#include <sawyer/MemoryMappedFile.h>
+#include <sawyer/Stream.h>
+
+using namespace cs;
+using namespace gxc;
+
+// Increase when the output of a build changes for the same input
+constexpr uint32_t cacheVersion = 2;
+constexpr uint32_t cacheMagic = 0x43435847; // GXCC
+
+namespace
+{
+    // 64-bit FNV-1a
+    class Hasher
+    {
+    private:
+        uint64_t _hash = 0xCBF29CE484222325;
+
+    public:
+        void update(const void* data, size_t len)
+        {
+            auto src = static_cast<const uint8_t*>(data);
+            auto hash = _hash;
+            for (size_t i = 0; i < len; i++)
+            {
+                hash = (hash ^ src[i]) * 0x100000001B3;
+            }
+            _hash = hash;
+        }
+
+        template<typename T>
+        void update(const T& value)
+        {
+            update(&value, sizeof(T));
+        }
+
+        uint64_t getHash() const
+        {
+            return _hash;
+        }
+    };
+}
+
+BuildCache::BuildCache(const fs::path& path)
+{
+    try
+    {
+        if (!fs::exists(path))
+            return;
+
+        FastBuffer buffer;
+        FileStream::readAllBytes(path, buffer);
+        BinaryStream bs(buffer.getSpan());
+        BinaryReader br(bs);
+        if (br.read<uint32_t>() != cacheMagic || br.read<uint32_t>() != cacheVersion)
+            return;
+
+        auto numItems = br.read<uint32_t>();
+        for (uint32_t i = 0; i < numItems; i++)
+        {
+            auto key = br.read<uint64_t>();
+
+            BuiltEntry item;
+            item.entry.width = br.read<int16_t>();
+            item.entry.height = br.read<int16_t>();
+            item.entry.offsetX = br.read<int16_t>();
+            item.entry.offsetY = br.read<int16_t>();
+            item.entry.flags = br.read<uint16_t>();
+            item.data.resize(br.read<uint32_t>());
+            bs.read(item.data.data(), item.data.size());
+            _items[key] = std::move(item);
+        }
+    }
+    catch (const std::exception&)
+    {
+        // Rebuild everything rather than fail
+        _items.clear();
+    }
+}
+
+uint64_t BuildCache::getFileHash(const fs::path& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _fileHashes.find(path);
+        if (it != _fileHashes.end())
+            return it->second;
+    }
+
+    MemoryMappedFile file(path);
+    Hasher hasher;
+    hasher.update(file.data(), file.size());
+    auto hash = hasher.getHash();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _fileHashes[path] = hash;
+    return hash;
+}
+
+uint64_t BuildCache::getKey(const SpriteManifest::Entry& manifestEntry, ImageConverter::ConvertMode mode, ColourDistance distance)
+{
+    Hasher hasher;
+    hasher.update(getFileHash(manifestEntry.path));
+    hasher.update(manifestEntry.format);
+    hasher.update(manifestEntry.palette);
+    hasher.update(manifestEntry.offsetX);
+    hasher.update(manifestEntry.offsetY);
+    hasher.update(manifestEntry.zoomOffset);
+    hasher.update(manifestEntry.srcX);
+    hasher.update(manifestEntry.srcY);
+    hasher.update(manifestEntry.srcWidth);
+    hasher.update(manifestEntry.srcHeight);
+    hasher.update(mode);
+    hasher.update(distance);
+    return hasher.getHash();
+}
+
+std::optional<BuiltEntry> BuildCache::find(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _items.find(key);
+    if (it == _items.end())
+        return std::nullopt;
+
+    _usedKeys.insert(key);
+    return it->second;
+}
+
+void BuildCache::add(uint64_t key, const BuiltEntry& builtEntry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _items[key] = builtEntry;
+    _usedKeys.insert(key);
+}
+
+void BuildCache::save(const fs::path& path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    MemoryStream ms;
+    BinaryWriter bw(ms);
+    bw.write(cacheMagic);
+    bw.write(cacheVersion);
+    bw.write(static_cast<uint32_t>(_usedKeys.size()));
+    for (auto key : _usedKeys)
+    {
+        const auto& item = _items.at(key);
+        bw.write(key);
+        bw.write(item.entry.width);
+        bw.write(item.entry.height);
+        bw.write(item.entry.offsetX);
+        bw.write(item.entry.offsetY);
+        bw.write(item.entry.flags);
+        bw.write(static_cast<uint32_t>(item.data.size()));
+        ms.write(item.data.data(), item.data.size());
+    }
+    FileStream::writeAllBytes(path, ms.data(), static_cast<size_t>(ms.getLength()));
+}
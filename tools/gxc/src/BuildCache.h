@@ -0,0 +1,52 @@
+#pragma once
+
+#include "SpriteArchive.h"
+#include "SpriteManifest.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sawyer/FileSystem.hpp>
+#include <sawyer/ImageConverter.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gxc
+{
+    struct BuiltEntry
+    {
+        SpriteArchive::Entry entry;
+        std::vector<std::byte> data;
+    };
+
+    /**
+     * Encoded entries from previous builds, keyed by a hash of everything an encoded entry
+     * depends on: the contents of the source image file, the manifest entry and the conversion
+     * mode and colour distance. Only entries used by the current build are kept when the cache is saved.
+     *
+     * All functions are safe to call from multiple threads.
+     */
+    class BuildCache
+    {
+    private:
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, BuiltEntry> _items;
+        std::unordered_set<uint64_t> _usedKeys;
+        std::map<fs::path, uint64_t> _fileHashes;
+
+        uint64_t getFileHash(const fs::path& path);
+
+    public:
+        /**
+         * Loads the cache, an empty cache is used if the file does not exist or is invalid.
+         */
+        BuildCache(const fs::path& path);
+
+        uint64_t getKey(const SpriteManifest::Entry& manifestEntry, ImageConverter::ConvertMode mode, ColourDistance distance);
+        std::optional<BuiltEntry> find(uint64_t key);
+        void add(uint64_t key, const BuiltEntry& builtEntry);
+        void save(const fs::path& path);
+    };
+}
@@ -1,6 +1,8 @@
 #include "SpriteArchive.h"
 #include <algorithm>
+#include <cstring>
 #include <sawyer/Stream.h>
+#include <stdexcept>
 
 using namespace cs;
 using namespace gxc;
@@ -8,50 +10,61 @@ using namespace gxc;
 SpriteArchive SpriteArchive::fromFile(const fs::path& path)
 {
     SpriteArchive archive;
-
-    FileStream fs(path, StreamFlags::read);
-    BinaryReader br(fs);
+    archive._file = std::make_shared<MemoryMappedFile>(path);
+    auto file = archive._file->getSpan();
 
     // Read header
     GxHeader header;
-    header.numEntries = br.read<uint32_t>();
-    header.dataSize = br.read<uint32_t>();
-
-    // Read entries
-    std::vector<uint32_t> offsets;
-    archive._entries.resize(header.numEntries);
-    for (uint32_t i = 0; i < header.numEntries; i++)
+    if (file.size() < sizeof(uint32_t) * 2)
+        throw std::runtime_error("Failed to read data");
+    std::memcpy(&header.numEntries, file.data(), sizeof(uint32_t));
+    std::memcpy(&header.dataSize, file.data() + sizeof(uint32_t), sizeof(uint32_t));
+
+    auto recordsOffset = sizeof(uint32_t) * 2;
+    auto dataOffset = recordsOffset + static_cast<uint64_t>(header.numEntries) * sizeof(EntryRecord);
+    if (file.size() < dataOffset + header.dataSize)
+        throw std::runtime_error("Failed to read data");
+
+    // Entries and data are used directly from the mapped file
+    archive._records = stdx::span<const EntryRecord>(reinterpret_cast<const EntryRecord*>(file.data() + recordsOffset), header.numEntries);
+    archive._mappedData = file.subspan(static_cast<size_t>(dataOffset), header.dataSize);
+
+    // Determine data length of each entry by capping at offset of next. Entries are almost
+    // always in data order, so a single backwards pass over the entries is usually enough.
+    auto& records = archive._records;
+    auto& dataLengths = archive._dataLengths;
+    dataLengths.resize(records.size());
+    auto nextOffset = header.dataSize;
+    auto lowestOffset = header.dataSize;
+    auto ordered = true;
+    for (size_t i = records.size(); i-- > 0;)
     {
-        auto& entry = archive._entries[i];
-
-        entry.dataOffset = br.read<uint32_t>();
-        entry.width = br.read<uint16_t>();
-        entry.height = br.read<uint16_t>();
-        entry.offsetX = br.read<uint16_t>();
-        entry.offsetY = br.read<uint16_t>();
-        entry.flags = br.read<uint16_t>();
-        entry.zoomOffset = br.read<uint16_t>();
-
-        offsets.push_back(static_cast<uint32_t>(entry.dataOffset));
+        auto offset = std::min(records[i].dataOffset, header.dataSize);
+        if (offset > lowestOffset)
+        {
+            ordered = false;
+            break;
+        }
+        if (offset < lowestOffset)
+        {
+            nextOffset = lowestOffset;
+            lowestOffset = offset;
+        }
+        dataLengths[i] = nextOffset - offset;
     }
-
-    // Read data
-    archive._data.resize(header.dataSize);
-    fs.read(archive._data.data(), header.dataSize);
-
-    // Determine data length of each entry by capping at offset of next
-    std::sort(offsets.begin(), offsets.end());
-    for (uint32_t i = 0; i < header.numEntries; i++)
+    if (!ordered)
     {
-        auto& entry = archive._entries[i];
-        auto it = std::lower_bound(offsets.begin(), offsets.end(), static_cast<uint32_t>(entry.dataOffset + 1));
-        if (it != offsets.end())
+        std::vector<uint32_t> offsets(records.size());
+        for (size_t i = 0; i < records.size(); i++)
         {
-            entry.dataLength = *it - entry.dataOffset;
+            offsets[i] = std::min(records[i].dataOffset, header.dataSize);
         }
-        else
+        std::sort(offsets.begin(), offsets.end());
+        for (size_t i = 0; i < records.size(); i++)
         {
-            entry.dataLength = header.dataSize - entry.dataOffset;
+            auto offset = std::min(records[i].dataOffset, header.dataSize);
+            auto it = std::upper_bound(offsets.begin(), offsets.end(), offset);
+            dataLengths[i] = (it != offsets.end() ? *it : header.dataSize) - offset;
         }
     }
 
@@ -60,36 +73,54 @@ SpriteArchive SpriteArchive::fromFile(const fs::path& path)
 
 uint32_t SpriteArchive::getNumEntries() const
 {
-    return static_cast<uint32_t>(_entries.size());
+    return static_cast<uint32_t>(_file != nullptr ? _records.size() : _entries.size());
 }
 
 uint32_t SpriteArchive::getDataSize() const
 {
-    return static_cast<uint32_t>(_data.size());
+    return static_cast<uint32_t>(getData().size());
+}
+
+stdx::span<const std::byte> SpriteArchive::getData() const
+{
+    if (_file != nullptr)
+        return _mappedData;
+    return stdx::span<const std::byte>(_data.data(), _data.size());
 }
 
-const SpriteArchive::Entry& SpriteArchive::getEntry(uint32_t index) const
+SpriteArchive::Entry SpriteArchive::getEntry(uint32_t index) const
 {
-    if (index >= _entries.size())
+    if (index >= getNumEntries())
         throw std::invalid_argument("Invalid index");
 
-    return _entries[index];
+    if (_file == nullptr)
+        return _entries[index];
+
+    const auto& record = _records[index];
+    Entry entry;
+    entry.dataOffset = record.dataOffset;
+    entry.dataLength = _dataLengths[index];
+    entry.width = record.width;
+    entry.height = record.height;
+    entry.offsetX = record.offsetX;
+    entry.offsetY = record.offsetY;
+    entry.flags = record.flags;
+    entry.zoomOffset = record.zoomOffset;
+    return entry;
 }
 
 stdx::span<const std::byte> SpriteArchive::getEntryData(uint32_t index) const
 {
-    if (index >= _entries.size())
-        throw std::invalid_argument("Invalid index");
-
-    const auto& entry = _entries[index];
-    const auto* ptr = _data.data() + entry.dataOffset;
-    return stdx::span<const std::byte>(ptr, entry.dataLength);
+    auto entry = getEntry(index);
+    auto data = getData();
+    auto offset = std::min<size_t>(entry.dataOffset, data.size());
+    return data.subspan(offset, std::min<size_t>(entry.dataLength, data.size() - offset));
 }
 
 GxEntry SpriteArchive::getGx(uint32_t index) const
 {
-    const auto& entry = getEntry(index);
-    const auto& entryData = getEntryData(index);
+    auto entry = getEntry(index);
+    auto entryData = getEntryData(index);
 
     GxEntry gx;
     gx.offset = entryData.data();
@@ -112,8 +143,36 @@ void SpriteArchive::addEmptyEntry()
     addEntry(entry, stdx::span(&data, 1));
 }
 
+void SpriteArchive::detach()
+{
+    if (_file == nullptr)
+        return;
+
+    std::vector<Entry> entries(_records.size());
+    for (uint32_t i = 0; i < entries.size(); i++)
+    {
+        entries[i] = getEntry(i);
+    }
+    _data.assign(_mappedData.begin(), _mappedData.end());
+    _entries = std::move(entries);
+
+    _records = {};
+    _mappedData = {};
+    _dataLengths = {};
+    _file = nullptr;
+}
+
 void SpriteArchive::addEntry(const Entry& entry, stdx::span<const std::byte> data)
 {
+    // Take a copy first in case the data refers to this archive
+    std::vector<std::byte> dataCopy;
+    if (_file != nullptr)
+    {
+        dataCopy.assign(data.begin(), data.end());
+        data = stdx::span<const std::byte>(dataCopy.data(), dataCopy.size());
+        detach();
+    }
+
     _entries.push_back(entry);
 
     auto& newEntry = _entries.back();
@@ -124,26 +183,38 @@ void SpriteArchive::addEntry(const Entry& entry, stdx::span<const std::byte> dat
 
 void SpriteArchive::writeToFile(const fs::path& path)
 {
-    FileStream fs(path, StreamFlags::write);
-    BinaryWriter bw(fs);
-
-    // Write header
-    bw.write(getNumEntries());
-    bw.write(getDataSize());
+    GxHeader header;
+    header.numEntries = getNumEntries();
+    header.dataSize = getDataSize();
 
-    // Write entries
-    for (size_t i = 0; i < _entries.size(); i++)
+    std::vector<EntryRecord> records;
+    auto recordData = stdx::span<const EntryRecord>(_records);
+    if (_file == nullptr)
     {
-        auto& entry = _entries[i];
-        bw.write(static_cast<uint32_t>(entry.dataOffset));
-        bw.write(entry.width);
-        bw.write(entry.height);
-        bw.write(entry.offsetX);
-        bw.write(entry.offsetY);
-        bw.write(entry.flags);
-        bw.write(entry.zoomOffset);
+        records.resize(_entries.size());
+        for (size_t i = 0; i < _entries.size(); i++)
+        {
+            const auto& entry = _entries[i];
+            auto& record = records[i];
+            record.dataOffset = entry.dataOffset;
+            record.width = entry.width;
+            record.height = entry.height;
+            record.offsetX = entry.offsetX;
+            record.offsetY = entry.offsetY;
+            record.flags = entry.flags;
+            record.zoomOffset = entry.zoomOffset;
+        }
+        recordData = stdx::span<const EntryRecord>(records.data(), records.size());
     }
 
-    // Write data
-    fs.write(_data.data(), _data.size());
+    // Write header, entries and data
+    StreamBuffer buffers[] = {
+        { &header.numEntries, sizeof(header.numEntries) },
+        { &header.dataSize, sizeof(header.dataSize) },
+        { recordData.data(), recordData.size_bytes() },
+        { getData().data(), getData().size() },
+    };
+    FileStream fs(path, StreamFlags::write | StreamFlags::atomic);
+    fs.writev(buffers);
+    fs.commit();
 }
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <sawyer/FileSystem.hpp>
 #include <sawyer/Gx.h>
+#include <sawyer/MemoryMappedFile.h>
 #include <sawyer/Span.hpp>
+#include <vector>
 
 using namespace cs;
 
@@ -24,11 +27,15 @@ namespace gxc
             uint16_t zoomOffset{};
         };
 
+        /**
+         * Maps the file into memory and uses its entry table and data directly. The mapping is
+         * copied into memory the first time the archive is modified.
+         */
         static SpriteArchive fromFile(const fs::path& path);
 
         uint32_t getNumEntries() const;
         uint32_t getDataSize() const;
-        const Entry& getEntry(uint32_t index) const;
+        Entry getEntry(uint32_t index) const;
         stdx::span<const std::byte> getEntryData(uint32_t index) const;
         GxEntry getGx(uint32_t index) const;
 
@@ -37,7 +44,31 @@ namespace gxc
         void writeToFile(const fs::path& path);
 
     private:
+#pragma pack(push, 1)
+        // Entry as stored in the gx file
+        struct EntryRecord
+        {
+            uint32_t dataOffset;
+            int16_t width;
+            int16_t height;
+            int16_t offsetX;
+            int16_t offsetY;
+            uint16_t flags;
+            uint16_t zoomOffset;
+        };
+#pragma pack(pop)
+        static_assert(sizeof(EntryRecord) == 16);
+
+        // Archives read from a file refer to the mapped file until they are modified
+        std::shared_ptr<MemoryMappedFile> _file;
+        stdx::span<const EntryRecord> _records;
+        stdx::span<const std::byte> _mappedData;
+        std::vector<uint32_t> _dataLengths;
+
         std::vector<Entry> _entries;
         std::vector<std::byte> _data;
+
+        void detach();
+        stdx::span<const std::byte> getData() const;
     };
 }
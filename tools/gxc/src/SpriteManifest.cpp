@@ -210,7 +210,7 @@ std::string SpriteManifest::buildManifest(const SpriteArchive& archive)
     auto numEntries = archive.getNumEntries();
     for (uint32_t i = 0; i < numEntries; i++)
     {
-        auto& entry = archive.getEntry(i);
+        auto entry = archive.getEntry(i);
         sb.append("    {\n");
 
         char filename[32];
@@ -1,22 +1,33 @@
 #include "gxc.h"
+#include "BuildCache.h"
 #include "SpriteArchive.h"
 #include "SpriteManifest.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <future>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <sawyer/CommandLine.h>
 #include <sawyer/Image.h>
 #include <sawyer/ImageConverter.h>
 #include <sawyer/Palette.h>
 #include <sawyer/SawyerStream.h>
+#include <sawyer/SpriteCache.h>
 #include <sawyer/Stream.h>
+#include <sawyer/ThreadPool.h>
 #include <string>
 #include <string_view>
 
 using namespace cs;
 using namespace gxc;
 
+constexpr uint32_t exportBatchSize = 64;
+constexpr size_t exportCacheBudget = 4 * 1024 * 1024;
+
 static void convertPaletteToBmp(const GxEntry& entry, void* dst)
 {
     auto src8 = static_cast<const uint8_t*>(entry.offset);
@@ -32,9 +43,9 @@ static void convertPaletteToBmp(const GxEntry& entry, void* dst)
     }
 }
 
-static void encodePalette(Stream& stream, const Image& image)
+static void encodePalette(Stream& stream, const ImageView& image)
 {
-    const auto* src = image.pixels.data();
+    const auto* src = image.pixels;
     for (uint32_t x = 0; x < image.width; x++)
     {
         PaletteBGRA colour;
@@ -103,118 +114,277 @@ static ImageConverter::ConvertMode parseConvertMode(std::string_view s)
         throw std::runtime_error("Unknown or unsupported convert mode");
 }
 
+static ColourDistance parseColourDistance(std::string_view s)
+{
+    if (s.empty() || s == "rgb")
+        return ColourDistance::rgb;
+    else if (s == "cielab")
+        return ColourDistance::cielab;
+    else if (s == "oklab")
+        return ColourDistance::oklab;
+    else
+        throw std::runtime_error("Unknown colour distance");
+}
+
+namespace
+{
+    /**
+     * Decoded PNG images shared between manifest entries. Each file is only decoded once, even
+     * when it is requested by several threads at the same time.
+     */
+    class ImageCache
+    {
+    private:
+        using ImageFuture = std::shared_future<std::shared_ptr<const Image>>;
+
+        std::mutex _mutex;
+        std::map<fs::path, ImageFuture> _images;
+
+    public:
+        std::shared_ptr<const Image> get(const fs::path& path)
+        {
+            std::promise<std::shared_ptr<const Image>> promise;
+            ImageFuture image;
+            auto load = false;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = _images.find(path);
+                if (it == _images.end())
+                {
+                    image = promise.get_future().share();
+                    _images.emplace(path, image);
+                    load = true;
+                }
+                else
+                {
+                    image = it->second;
+                }
+            }
+
+            if (load)
+            {
+                try
+                {
+                    FileStream fs(path, StreamFlags::read);
+                    promise.set_value(std::make_shared<const Image>(Image::fromPng(fs)));
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+            return image.get();
+        }
+    };
+}
+
+static BuiltEntry buildEntry(const SpriteManifest::Entry& manifestEntry, ImageCache& imageCache, ImageConverter& converter, ImageConverter::ConvertMode convertMode)
+{
+    auto sourceImage = imageCache.get(manifestEntry.path);
+    auto img = sourceImage->getView();
+
+    Image croppedImage;
+    if (manifestEntry.srcWidth != 0 || manifestEntry.srcHeight != 0)
+    {
+        if (manifestEntry.srcWidth <= 0 || manifestEntry.srcHeight <= 0)
+            throw std::runtime_error("srcWidth and srcHeight must be > 0");
+
+        // Slice the sprite out of the shared sheet, only copying if it extends beyond the sheet
+        auto x = manifestEntry.srcX;
+        auto y = manifestEntry.srcY;
+        auto w = static_cast<uint32_t>(manifestEntry.srcWidth);
+        auto h = static_cast<uint32_t>(manifestEntry.srcHeight);
+        if (img.contains(x, y, w, h))
+        {
+            img = img.slice(x, y, w, h);
+        }
+        else
+        {
+            croppedImage = sourceImage->crop(x, y, w, h);
+            img = croppedImage.getView();
+        }
+    }
+
+    BuiltEntry result;
+    auto& entry = result.entry;
+    if (manifestEntry.format == SpriteManifest::Format::palette)
+    {
+        MemoryStream ms;
+        encodePalette(ms, img);
+
+        entry.width = img.width;
+        entry.height = 1;
+        entry.offsetX = manifestEntry.offsetX;
+        entry.flags = GxFlags::isPalette;
+        auto data = ms.asSpan<const std::byte>();
+        result.data.assign(data.begin(), data.end());
+        return result;
+    }
+
+    Image convertedImage;
+    if (manifestEntry.palette == SpriteManifest::PaletteKind::keep)
+    {
+        if (img.depth != 8)
+            throw std::runtime_error("Expected image depth to be 8");
+    }
+    else
+    {
+        convertedImage = converter.convertTo8bpp(img, convertMode);
+        img = convertedImage.getView();
+    }
+
+    entry.width = img.width;
+    entry.height = img.height;
+    entry.offsetX = manifestEntry.offsetX;
+    entry.offsetY = manifestEntry.offsetY;
+
+    if (manifestEntry.format == SpriteManifest::Format::automatic || manifestEntry.format == SpriteManifest::Format::rle)
+    {
+        ImageBuffer8 imageBuffer;
+        imageBuffer.width = img.width;
+        imageBuffer.height = img.height;
+        imageBuffer.data = img.pixels;
+        imageBuffer.stride = img.stride;
+
+        GxEncoder encoder;
+        FastBuffer encodeBuffer;
+        if (manifestEntry.format == SpriteManifest::Format::rle)
+        {
+            encoder.encodeRle(imageBuffer, encodeBuffer);
+            entry.flags = GxFlags::transparent | GxFlags::rle;
+        }
+        else
+        {
+            entry.flags = encoder.encodeSmallest(imageBuffer, encodeBuffer);
+        }
+        auto data = reinterpret_cast<const std::byte*>(encodeBuffer.data());
+        result.data.assign(data, data + encodeBuffer.size());
+        return result;
+    }
+
+    entry.flags = GxFlags::transparent;
+    result.data.reserve(static_cast<size_t>(img.width) * img.height);
+    for (uint32_t y = 0; y < img.height; y++)
+    {
+        auto row = reinterpret_cast<const std::byte*>(img.getRow(y));
+        result.data.insert(result.data.end(), row, row + img.width);
+    }
+    return result;
+}
+
 int runBuild(const CommandLineOptions& options)
 {
     auto manifest = SpriteManifest::fromFile(fs::path(options.manifestPath));
     auto outputPath = fs::path(options.path);
     auto convertMode = parseConvertMode(options.mode);
+    auto distance = parseColourDistance(options.distance);
 
     SpriteArchive archive;
 
     // Check we can write to the ouput path first
     archive.writeToFile(outputPath);
 
-    std::map<fs::path, Image> imageCache;
-    for (auto& manifestEntry : manifest.entries)
+    // Encoded entries from the previous build are reused if nothing they depend on has changed
+    auto cachePath = outputPath;
+    cachePath += ".cache";
+    std::optional<BuildCache> buildCache;
+    if (options.useCache)
     {
-        if (manifestEntry.format == SpriteManifest::Format::empty)
+        buildCache.emplace(cachePath);
+    }
+
+    // Entries are converted on the thread pool and added to the archive in manifest order
+    ImageCache imageCache;
+    ImageConverter converter(GetStandardPalette(), distance); // shared so its palette lookup tables are only built once
+    auto build = [&](const SpriteManifest::Entry& manifestEntry) {
+        if (!buildCache)
+            return buildEntry(manifestEntry, imageCache, converter, convertMode);
+
+        auto key = buildCache->getKey(manifestEntry, convertMode, distance);
+        auto cached = buildCache->find(key);
+        if (cached)
+            return std::move(*cached);
+
+        auto result = buildEntry(manifestEntry, imageCache, converter, convertMode);
+        buildCache->add(key, result);
+        return result;
+    };
+    std::atomic<bool> cancelled{};
+    std::vector<std::optional<BuiltEntry>> results(manifest.entries.size());
+    std::vector<std::future<void>> tasks(manifest.entries.size());
+    std::optional<ThreadPool> threadPool;
+    if (options.numThreads != 1)
+    {
+        threadPool.emplace(options.numThreads);
+        for (size_t i = 0; i < manifest.entries.size(); i++)
         {
-            for (auto i = 0; i < manifestEntry.count; i++)
+            if (manifest.entries[i].format != SpriteManifest::Format::empty)
             {
-                if (!options.quiet)
-                {
-                    std::cout << "Adding empty entry" << std::endl;
-                }
-                archive.addEmptyEntry();
+                tasks[i] = threadPool->enqueue([&, i]() {
+                    if (!cancelled)
+                    {
+                        results[i] = build(manifest.entries[i]);
+                    }
+                });
             }
-            continue;
         }
+    }
 
-        if (!options.quiet)
-        {
-            std::cout << "Adding " << manifestEntry.path << std::endl;
-        }
-        try
+    try
+    {
+        for (size_t i = 0; i < manifest.entries.size(); i++)
         {
-            auto imageCacheIterator = imageCache.find(manifestEntry.path);
-            if (imageCacheIterator == imageCache.end())
+            const auto& manifestEntry = manifest.entries[i];
+            if (manifestEntry.format == SpriteManifest::Format::empty)
             {
-                FileStream fs(manifestEntry.path, StreamFlags::read);
-                std::tie(imageCacheIterator, std::ignore) = imageCache.emplace(manifestEntry.path, Image::fromPng(fs));
-            }
-            auto img = imageCacheIterator->second.copy();
-
-            if (manifestEntry.srcWidth != 0 || manifestEntry.srcHeight != 0)
-            {
-                if (manifestEntry.srcWidth <= 0 || manifestEntry.srcHeight <= 0)
-                    throw std::runtime_error("srcWidth and srcHeight must be > 0");
-                img = img.crop(manifestEntry.srcX, manifestEntry.srcY, manifestEntry.srcWidth, manifestEntry.srcHeight);
+                for (auto j = 0; j < manifestEntry.count; j++)
+                {
+                    if (!options.quiet)
+                    {
+                        std::cout << "Adding empty entry" << std::endl;
+                    }
+                    archive.addEmptyEntry();
+                }
+                continue;
             }
 
-            if (manifestEntry.format == SpriteManifest::Format::palette)
+            if (!options.quiet)
             {
-                MemoryStream ms;
-                encodePalette(ms, img);
-
-                SpriteArchive::Entry entry;
-                entry.width = img.width;
-                entry.height = 1;
-                entry.offsetX = manifestEntry.offsetX;
-                entry.flags = GxFlags::isPalette;
-                archive.addEntry(entry, ms.asSpan<const std::byte>());
-                continue;
+                std::cout << "Adding " << manifestEntry.path << std::endl;
             }
-            else
+            try
             {
-                if (manifestEntry.palette == SpriteManifest::PaletteKind::keep)
+                if (threadPool)
                 {
-                    if (img.depth != 8)
-                        throw std::runtime_error("Expected image depth to be 8");
+                    tasks[i].get();
                 }
                 else
                 {
-                    ImageConverter converter;
-                    img = converter.convertTo8bpp(img, convertMode, GetStandardPalette());
+                    results[i] = build(manifestEntry);
                 }
 
-                if (img.stride != img.width)
-                    throw std::runtime_error("Expected image stride to be the image width");
-
-                SpriteArchive::Entry entry;
-                entry.width = img.width;
-                entry.height = img.height;
-                entry.offsetX = manifestEntry.offsetX;
-                entry.offsetY = manifestEntry.offsetY;
-
-                if (manifestEntry.format == SpriteManifest::Format::automatic || manifestEntry.format == SpriteManifest::Format::rle)
-                {
-                    ImageBuffer8 imageBuffer;
-                    imageBuffer.width = img.width;
-                    imageBuffer.height = img.height;
-                    imageBuffer.data = img.pixels.data();
-
-                    GxEncoder encoder;
-                    if (manifestEntry.format == SpriteManifest::Format::rle || encoder.isWorthUsingRle(imageBuffer))
-                    {
-                        MemoryStream ms;
-                        encoder.encodeRle(imageBuffer, ms);
-                        entry.flags = GxFlags::transparent | GxFlags::rle;
-                        archive.addEntry(entry, ms.asSpan<const std::byte>());
-                        continue;
-                    }
-                }
-
-                entry.flags = GxFlags::transparent;
-                archive.addEntry(entry, stdx::span<const std::byte>(reinterpret_cast<std::byte*>(img.pixels.data()), img.pixels.size()));
+                const auto& result = *results[i];
+                archive.addEntry(result.entry, stdx::span<const std::byte>(result.data.data(), result.data.size()));
+                results[i] = std::nullopt;
+            }
+            catch (const std::exception&)
+            {
+                std::cerr << "Failed to build " << manifestEntry.path << std::endl;
+                throw;
             }
         }
-        catch (const std::exception&)
-        {
-            std::cerr << "Failed to build " << manifestEntry.path << std::endl;
-            throw;
-        }
+    }
+    catch (...)
+    {
+        // Skip the remaining entries, the thread pool waits for the ones already running
+        cancelled = true;
+        throw;
     }
     archive.writeToFile(outputPath);
+    if (buildCache)
+    {
+        buildCache->save(cachePath);
+    }
     return ExitCodes::ok;
 }
 
@@ -276,7 +446,7 @@ static int runList(const CommandLineOptions& options)
     auto numEntries = archive->getNumEntries();
     for (uint32_t i = 0; i < numEntries; i++)
     {
-        const auto& entry = archive->getEntry(i);
+        auto entry = archive->getEntry(i);
         auto szFlags = stringifyFlags(entry.flags);
         std::printf("%05d 0x%08X %6u %5d %6d %7d %7d %10d %s\n", i, entry.dataOffset, entry.dataLength, entry.width, entry.height, entry.offsetX, entry.offsetY, entry.zoomOffset, szFlags.c_str());
     }
@@ -289,31 +459,70 @@ static void exportManifest(const SpriteArchive& archive, const fs::path& manifes
     FileStream::writeAllText(manifestPath, manifest);
 }
 
-static void exportImage(const GxEntry& entry, const Palette& palette, const fs::path& imageFilename)
+/**
+ * Decodes an entry into the image, reusing the image's pixel buffer.
+ */
+static void decodeEntry(const SpriteArchive& archive, uint32_t index, const std::shared_ptr<const Palette>& palette, Image& image)
 {
-    Image image;
-    if (entry.flags & GxFlags::isPalette)
+    auto gx = archive.getGx(index);
+    if (gx.flags & GxFlags::isPalette)
     {
-        image.width = entry.width;
+        image.width = gx.width;
         image.height = 1;
         image.depth = 32;
-        image.pixels = std::vector<uint8_t>(entry.width * 4);
-        image.stride = entry.width * 4;
-        convertPaletteToBmp(entry, image.pixels.data());
+        image.stride = gx.width * 4;
+        image.palette = nullptr;
+        image.pixels.resize(image.stride);
+        convertPaletteToBmp(gx, image.pixels.data());
     }
     else
     {
-        image.width = entry.width;
-        image.height = entry.height;
-        image.palette = std::make_unique<Palette>(palette);
+        image.width = gx.width;
+        image.height = gx.height;
         image.depth = 8;
-        image.pixels = std::vector<uint8_t>(entry.width * entry.height);
-        image.stride = entry.width;
-        entry.convertToBmp(image.pixels.data());
+        image.stride = gx.width;
+        image.palette = palette;
+
+        // RLE leaves transparent pixels untouched
+        image.pixels.assign(image.stride * image.height, 0);
+        gx.convertToBmp(image.pixels.data());
+    }
+}
+
+static SpriteCache createSpriteCache(const SpriteArchive& archive)
+{
+    return SpriteCache([&archive](uint32_t index) { return archive.getGx(index); }, archive.getNumEntries(), exportCacheBudget);
+}
+
+/**
+ * Decodes an entry as it is drawn at the zoom level, using the separate zoomed entry if it has one.
+ */
+static void decodeEntry(const SpriteArchive& archive, SpriteCache& cache, uint32_t index, uint8_t zoom, const std::shared_ptr<const Palette>& palette, Image& image)
+{
+    if (zoom == 0 || (archive.getEntry(index).flags & GxFlags::isPalette))
+    {
+        decodeEntry(archive, index, palette, image);
+        return;
     }
 
+    auto sprite = cache.get(index, zoom);
+    image.width = sprite->width;
+    image.height = sprite->height;
+    image.depth = 8;
+    image.stride = sprite->width;
+    image.palette = palette;
+    image.pixels.assign(sprite->pixels.begin(), sprite->pixels.end());
+}
+
+static PngOptions getPngOptions(const CommandLineOptions& options)
+{
+    return options.fastPng ? PngOptions::fast() : PngOptions();
+}
+
+static void writePng(const Image& image, const fs::path& imageFilename, const PngOptions& pngOptions)
+{
     FileStream pngfs(imageFilename, StreamFlags::write);
-    image.toPng(pngfs);
+    image.toPng(pngfs, pngOptions);
 }
 
 static int runExport(const CommandLineOptions& options)
@@ -334,10 +543,12 @@ static int runExport(const CommandLineOptions& options)
     auto numEntries = archive->getNumEntries();
     if (idx >= 0 && static_cast<uint32_t>(idx) < numEntries)
     {
-        const auto gx = archive->getGx(idx);
-        auto& palette = GetStandardPalette();
+        auto palette = std::make_shared<const Palette>(GetStandardPalette());
         auto imageFilename = fs::u8path(options.outputPath);
-        exportImage(gx, palette, imageFilename);
+        Image image;
+        auto cache = createSpriteCache(*archive);
+        decodeEntry(*archive, cache, idx, options.zoom, palette, image);
+        writePng(image, imageFilename, getPngOptions(options));
         return ExitCodes::ok;
     }
     else
@@ -358,23 +569,79 @@ static int runExportAll(const CommandLineOptions& options)
     auto outputDirectory = fs::u8path(options.outputPath);
     if (fs::is_directory(outputDirectory) || fs::create_directories(outputDirectory))
     {
-        exportManifest(*archive, outputDirectory / "manifest.json");
-
-        auto& palette = GetStandardPalette();
-        auto numEntries = archive->getNumEntries();
-        for (uint32_t i = 0; i < numEntries; i++)
+        // Zoomed images can not be built back into the same archive
+        if (options.zoom == 0)
         {
-            const auto gx = archive->getGx(i);
+            exportManifest(*archive, outputDirectory / "manifest.json");
+        }
 
+        // All images share the same palette and each batch reuses one pixel buffer. Zoomed entries
+        // are decoded ahead through a cache for each batch.
+        auto palette = std::make_shared<const Palette>(GetStandardPalette());
+        auto pngOptions = getPngOptions(options);
+        auto numEntries = archive->getNumEntries();
+        std::atomic<bool> cancelled{};
+        auto getFilename = [](uint32_t index) {
             char filename[32]{};
-            std::snprintf(filename, sizeof(filename), "%05d.png", i);
-            if (!options.quiet)
+            std::snprintf(filename, sizeof(filename), "%05d.png", index);
+            return std::string(filename);
+        };
+        auto exportBatch = [&](uint32_t begin, uint32_t end, bool printProgress) {
+            Image image;
+            auto cache = createSpriteCache(*archive);
+            if (options.zoom > 0)
             {
-                printf("Writing %s...\n", filename);
+                cache.prefetch(begin, end - begin, options.zoom);
             }
+            for (auto i = begin; i < end && !cancelled; i++)
+            {
+                auto filename = getFilename(i);
+                if (printProgress)
+                {
+                    std::printf("Writing %s...\n", filename.c_str());
+                }
+
+                decodeEntry(*archive, cache, i, options.zoom, palette, image);
+                writePng(image, outputDirectory / filename, pngOptions);
+            }
+        };
 
-            auto imageFilename = outputDirectory / filename;
-            exportImage(gx, palette, imageFilename);
+        if (options.numThreads == 1)
+        {
+            exportBatch(0, numEntries, !options.quiet);
+        }
+        else
+        {
+            ThreadPool threadPool(options.numThreads);
+            std::vector<std::future<void>> tasks;
+            for (uint32_t i = 0; i < numEntries; i += exportBatchSize)
+            {
+                auto end = std::min(numEntries, i + exportBatchSize);
+                tasks.push_back(threadPool.enqueue([&exportBatch, i, end]() { exportBatch(i, end, false); }));
+            }
+            try
+            {
+                // Progress is printed in order as each batch completes, rather than from the pool threads
+                for (size_t t = 0; t < tasks.size(); t++)
+                {
+                    tasks[t].get();
+                    if (!options.quiet)
+                    {
+                        auto begin = static_cast<uint32_t>(t) * exportBatchSize;
+                        auto end = std::min(numEntries, begin + exportBatchSize);
+                        for (auto i = begin; i < end; i++)
+                        {
+                            std::printf("Writing %s...\n", getFilename(i).c_str());
+                        }
+                    }
+                }
+            }
+            catch (...)
+            {
+                // Skip the remaining entries, the thread pool waits for the ones already running
+                cancelled = true;
+                throw;
+            }
         }
         return ExitCodes::ok;
     }
@@ -404,8 +671,8 @@ static int runMerge(const CommandLineOptions& options)
         auto numEntries = nextInput->getNumEntries();
         for (uint32_t j = 0; j < numEntries; j++)
         {
-            const auto& entry = nextInput->getEntry(j);
-            const auto& data = nextInput->getEntryData(j);
+            auto entry = nextInput->getEntry(j);
+            auto data = nextInput->getEntryData(j);
             input0->addEntry(entry, data);
         }
     }
@@ -435,7 +702,12 @@ static std::optional<CommandLineOptions> parseCommandLine(int argc, const char**
 {
     auto parser = CommandLineParser(argc, argv)
                       .registerOption("-m", 1)
+                      .registerOption("-d", 1)
                       .registerOption("-q")
+                      .registerOption("-j", 1)
+                      .registerOption("-z", 1)
+                      .registerOption("--cache", "-c")
+                      .registerOption("--fast")
                       .registerOption("--help", "-h")
                       .registerOption("--version");
     if (!parser.parse())
@@ -514,7 +786,30 @@ static std::optional<CommandLineOptions> parseCommandLine(int argc, const char**
     }
 
     options.mode = parser.getArg("-m");
+    options.distance = parser.getArg("-d");
     options.quiet = parser.hasOption("-q");
+    options.useCache = parser.hasOption("--cache") || parser.hasOption("-c");
+    options.fastPng = parser.hasOption("--fast");
+    if (parser.hasOption("-j"))
+    {
+        auto numThreads = parser.getArg<int32_t>("-j");
+        if (!numThreads || *numThreads < 0)
+        {
+            std::cerr << "Invalid number of threads" << std::endl;
+            return {};
+        }
+        options.numThreads = static_cast<uint32_t>(*numThreads);
+    }
+    if (parser.hasOption("-z"))
+    {
+        auto zoom = parser.getArg<int32_t>("-z");
+        if (!zoom || *zoom < 0 || *zoom > 7)
+        {
+            std::cerr << "Invalid zoom level" << std::endl;
+            return {};
+        }
+        options.zoom = static_cast<uint8_t>(*zoom);
+    }
 
     return options;
 }
@@ -542,6 +837,11 @@ static void printHelp()
     std::cout << "           upgrade   <gx_file> <csg1i.dat> <csg1.1>" << std::endl;
     std::cout << "options:" << std::endl;
     std::cout << "           -m <mode>  Image conversion mode (default, closest, or dithering)" << std::endl;
+    std::cout << "           -d <dist>  Colour distance for closest and dithering (rgb, cielab, or oklab)" << std::endl;
+    std::cout << "--cache    -c         Reuse unchanged entries from the previous build (stored in <gx_file>.cache)" << std::endl;
+    std::cout << "--fast                Export PNGs with faster, lighter compression" << std::endl;
+    std::cout << "           -j <n>     Number of threads to build or export with, 0 for one per core (default 1)" << std::endl;
+    std::cout << "           -z <zoom>  Zoom level to export images at, 0 to 7 (default 0)" << std::endl;
     std::cout << "           -q         Quiet" << std::endl;
     std::cout << "--help     -h         Print help" << std::endl;
     std::cout << "--version             Print version" << std::endl;
@@ -38,10 +38,15 @@ namespace gxc
         std::string manifestPath;
         std::optional<int32_t> idx;
         std::string mode;
+        std::string distance;
         std::string csgHeaderPath;
         std::string csgDataPath;
         std::vector<std::string> inputPath;
         bool quiet{};
+        uint32_t numThreads = 1;
+        bool useCache{};
+        bool fastPng{};
+        uint8_t zoom{};
     };
 
     const cs::Palette& GetStandardPalette();